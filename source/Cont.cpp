@@ -4,144 +4,123 @@
 
 #include "Cont.hpp"
 #include "Step.hpp"
+#include "memo.hpp"
 
-PTR(Cont) Cont::done = NEW(DoneCont)();
-
-DoneCont::DoneCont() { }
-
-void DoneCont::step_continue() {
-    throw std::runtime_error("can't continue done");
-}
-
-RightThenAddCont::RightThenAddCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest) {
-    this->rhs = rhs;
+Cont::Cont(tag_t tag, PTR(Expr) expr, PTR(Env) env) {
+    this->tag = tag;
+    this->expr = expr;
+    this->slot = -1;
     this->env = env;
-    this->rest = rest;
-}
-
-void RightThenAddCont::step_continue() {
-    PTR(Val) lhs_val = Step::val;
-    Step::mode = Step::interp_mode;
-    Step::expr = rhs;
-    Step::env = env;
-    Step::cont = NEW(AddCont)(lhs_val, rest);
 }
 
-AddCont::AddCont(PTR(Val) lhs_val, PTR(Cont) rest) {
-    this->lhs_val = lhs_val;
-    this->rest = rest;
-}
-
-void AddCont::step_continue() {
-    PTR(Val) rhs_val = Step::val;
-    Step::mode = Step::continue_mode;
-    Step::val = lhs_val->add_to(rhs_val);
-    Step::cont = rest;
-}
-
-RightThenMultCont::RightThenMultCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest) {
-    this->rhs = rhs;
-    this->env = env;
-    this->rest = rest;
-}
-
-void RightThenMultCont::step_continue() {
-    PTR(Val) lhs_val = Step::val;
-    Step::mode = Step::interp_mode;
-    Step::expr = rhs;
-    Step::env = env;
-    Step::cont = NEW(MultCont)(lhs_val, rest);
-}
-
-MultCont::MultCont(PTR(Val) lhs_val, PTR(Cont) rest) {
-    this->lhs_val = lhs_val;
-    this->rest = rest;
-}
-
-void MultCont::step_continue() {
-    PTR(Val) rhs_val = Step::val;
-    Step::mode = Step::continue_mode;
-    Step::val = lhs_val->mult_with(rhs_val);
-    Step::cont = rest;
-}
-
-IfBranchCont::IfBranchCont(PTR(Expr) then_part, PTR(Expr) else_part, PTR(Env) env, PTR(Cont) rest) {
-    this->then_part = then_part;
+Cont::Cont(PTR(Expr) then_part, PTR(Expr) else_part, PTR(Env) env) {
+    this->tag = if_branch;
+    this->expr = then_part;
     this->else_part = else_part;
+    this->slot = -1;
     this->env = env;
-    this->rest = rest;
 }
 
-void IfBranchCont::step_continue() {
-    PTR(Val) test_val = Step::val;
-    Step::mode = Step::interp_mode;
-
-    if (test_val->is_true()) Step::expr = then_part;
-    else Step::expr = else_part;
-
-    Step::env = env;
-    Step::cont = rest;
-}
-
-LetBodyCont::LetBodyCont(std::string var, PTR(Expr) body, PTR(Env) env, PTR(Cont) rest) {
+Cont::Cont(const Symbol &var, int slot, PTR(Expr) body, PTR(Env) env) {
+    this->tag = let_body;
     this->var = var;
-    this->body = body;
-    this->env = env;
-    this->rest = rest;
-}
-
-void LetBodyCont::step_continue() {
-    Step::mode = Step::interp_mode;
-    Step::expr = body;
-    Step::env = NEW(ExtendedEnv)(env, var, Step::val);
-
-    Step::cont = rest;
-}
-
-ArgThenCallCont::ArgThenCallCont(PTR(Expr) actual_arg, PTR(Env) env, PTR(Cont) rest) {
-    this->actual_arg = actual_arg;
-    this->env = env;
-    this->rest = rest;
-}
-
-void ArgThenCallCont::step_continue() {
-    Step::mode = Step::interp_mode;
-    Step::expr = actual_arg;
-    Step::env = env;
-    Step::cont = NEW(CallCont)(Step::val, rest);
-}
-
-CallCont::CallCont(PTR(Val) to_be_called_val, PTR(Cont) rest) {
-    this->to_be_called_val = to_be_called_val;
-    this->rest = rest;
-}
-
-void CallCont::step_continue() {
-    to_be_called_val->call_step(Step::val, rest);
-}
-
-RightThenCompCont::RightThenCompCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest) {
-    this->rhs = rhs;
+    this->slot = slot;
+    this->expr = body;
     this->env = env;
-    this->rest = rest;
 }
 
-void RightThenCompCont::step_continue() {
-    PTR(Val) lhs_val = Step::val;
-    Step::mode = Step::interp_mode;
-    Step::expr = rhs;
-    Step::env = env;
-    Step::cont = NEW(CompCont)(lhs_val, rest);
+void Cont::step_continue(Step &step) {
+    switch (tag) {
+        case right_then_add:
+        case right_then_mult:
+        case right_then_comp:
+            step.mode = Step::interp_mode;
+            step.expr = std::move(expr);
+            step.env = std::move(env);
+            tag = (tag == right_then_add) ? add : (tag == right_then_mult) ? mult : comp;
+            val = std::move(step.val);
+            break;
+
+        case add:
+            step.mode = Step::continue_mode;
+            step.val = Val::add(val, step.val);
+            step.conts.pop_back();
+            break;
+
+        case mult:
+            step.mode = Step::continue_mode;
+            step.val = Val::mult(val, step.val);
+            step.conts.pop_back();
+            break;
+
+        case comp:
+            step.mode = Step::continue_mode;
+            step.val = BoolVal::make(val->equals(step.val));
+            step.conts.pop_back();
+            break;
+
+        case memo_store: {
+            MemoCache &memo = MemoCache::local();
+            for (size_t i = 0; i + 1 < vals.size(); i += 2)
+                memo.store(vals[i], vals[i + 1], step.val);
+            step.conts.pop_back();
+            break;
+        }
+
+        case if_branch:
+            step.mode = Step::interp_mode;
+            if (step.val->is_true()) step.expr = std::move(expr);
+            else step.expr = std::move(else_part);
+            step.env = std::move(env);
+            step.conts.pop_back();
+            break;
+
+        case let_body:
+            step.mode = Step::interp_mode;
+            step.expr = std::move(expr);
+            if (slot >= 0) {
+                env->bind(slot, step.val);
+                step.env = std::move(env);
+            } else {
+                step.env = NEW(ExtendedEnv)(env, var, step.val);
+            }
+            step.conts.pop_back();
+            break;
+
+        case arg_then_call:
+            step.mode = Step::interp_mode;
+            step.expr = std::move(expr);
+            step.env = std::move(env);
+            tag = call;
+            val = std::move(step.val);
+            break;
+
+        case call: {
+            PTR(Val) to_be_called_val = std::move(val);
+            step.conts.pop_back();
+            to_be_called_val->call_step(step.val, step);
+            break;
+        }
+
+        case args_then_call: {
+            if (slot < 0)
+                val = std::move(step.val);
+            else
+                vals.push_back(std::move(step.val));
+            slot++;
+
+            const std::vector<PTR(Expr)> &actual_args = static_cast<CallExpr *>(&*expr)->actual_args;
+            if ((size_t) slot < actual_args.size()) {
+                step.mode = Step::interp_mode;
+                step.expr = actual_args[slot];
+                step.env = env;
+                break;
+            }
+            PTR(Val) to_be_called_val = std::move(val);
+            std::vector<PTR(Val)> actual_arg_vals = std::move(vals);
+            step.conts.pop_back();
+            to_be_called_val->call_step_with(std::move(actual_arg_vals), step);
+            break;
+        }
+    }
 }
-
-CompCont::CompCont(PTR(Val) lhs_val, PTR(Cont) rest) {
-    this->lhs_val = lhs_val;
-    this->rest = rest;
-}
-
-void CompCont::step_continue() {
-    PTR(Val) rhs_val = Step::val;
-    Step::mode = Step::continue_mode;
-    Step::val = NEW(BoolVal)(lhs_val->equals(rhs_val));
-    Step::cont = rest;
-}
\ No newline at end of file
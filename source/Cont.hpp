@@ -7,116 +7,47 @@
 #include "pointer.hpp"
 #include "Expr.hpp"
 
-class Cont;
-
-class Cont ENABLE_THIS(Cont) {
-public:
-    virtual void step_continue() = 0;
-
-    static PTR(Cont) done;
-};
-
-class DoneCont : public Cont {
-public:
-    DoneCont();
-    void step_continue();
-};
-
-class RightThenAddCont : public Cont {
-public:
-    PTR(Expr) rhs;
-    PTR(Env) env;
-    PTR(Cont) rest;
-
-    RightThenAddCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest);
-    void step_continue();
-};
-
-class AddCont : public Cont {
-public:
-    PTR(Val) lhs_val;
-    PTR(Cont) rest;
-
-    AddCont(PTR(Val) lhs_val, PTR(Cont) rest);
-    void step_continue();
-};
-
-class RightThenMultCont : public Cont {
-public:
-    PTR(Expr) rhs;
-    PTR(Env) env;
-    PTR(Cont) rest;
-
-    RightThenMultCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest);
-    void step_continue();
-};
-
-class MultCont : public Cont {
-public:
-    PTR(Val) lhs_val;
-    PTR(Cont) rest;
-
-    MultCont(PTR(Val) lhs_val, PTR(Cont) rest);
-    void step_continue();
-};
-
-class IfBranchCont : public Cont {
-public:
-    PTR(Expr) then_part;
+/**
+ * A <code>Cont</code> is one frame of the step machine's continuation stack.
+ * The tag says what to do with the next value, and only the fields that tag needs are set.
+ * Frames live by value in <code>Step::conts</code>, so pushing one does not allocate.
+ */
+class Cont {
+public:
+    typedef enum {
+        right_then_add,  // expr is the rhs to evaluate in env
+        add,             // val is the lhs to add to
+        right_then_mult, // expr is the rhs to evaluate in env
+        mult,            // val is the lhs to multiply with
+        if_branch,       // expr and else_part are the branches to pick from
+        let_body,        // var is bound, into slot if it has one, before evaluating expr in env
+        arg_then_call,   // expr is the argument to evaluate in env
+        call,            // val is the value to be called
+        args_then_call,  // expr is a CallExpr with several arguments, evaluated one at a time in env into val
+                         // and then vals; slot is the argument being evaluated, or -1 for the value to be called
+        right_then_comp, // expr is the rhs to evaluate in env
+        comp,            // val is the lhs to compare with
+        memo_store       // vals holds functions and the arguments they were called with, in turn, to cache the
+                         // value with
+    } tag_t;
+
+    tag_t tag;
+    PTR(Expr) expr;
     PTR(Expr) else_part;
+    Symbol var;
+    int slot;
     PTR(Env) env;
-    PTR(Cont) rest;
+    PTR(Val) val;
+    std::vector<PTR(Val)> vals;
 
-    IfBranchCont(PTR(Expr) then_part, PTR(Expr) else_part, PTR(Env) env, PTR(Cont) rest);
-    void step_continue();
-};
+    Cont(tag_t tag, PTR(Expr) expr, PTR(Env) env);
+    Cont(PTR(Expr) then_part, PTR(Expr) else_part, PTR(Env) env);
+    Cont(const Symbol &var, int slot, PTR(Expr) body, PTR(Env) env);
 
-class LetBodyCont : public Cont {
-public:
-    std::string var;
-    PTR(Expr) body;
-    PTR(Env) env;
-    PTR(Cont) rest;
-
-    LetBodyCont(std::string var, PTR(Expr) body, PTR(Env) env, PTR(Cont) rest);
-    void step_continue();
+    /**
+     * Hands the machine's value to this frame, which is the top of <code>step.conts</code>.
+     * The frame either pops itself or is replaced in place by the frame that follows it.
+     * @param step machine being run.
+     */
+    void step_continue(Step &step);
 };
-
-class ArgThenCallCont : public Cont {
-public:
-    PTR(Expr) actual_arg;
-    PTR(Env) env;
-    PTR(Cont) rest;
-
-    ArgThenCallCont(PTR(Expr) actual_arg, PTR(Env) env, PTR(Cont) rest);
-    void step_continue();
-};
-
-class CallCont : public Cont {
-public:
-    PTR(Val) to_be_called_val;
-    PTR(Cont) rest;
-
-    CallCont(PTR(Val) to_be_called_val, PTR(Cont) rest);
-    void step_continue();
-};
-
-class RightThenCompCont : public Cont {
-public:
-    PTR(Expr) rhs;
-    PTR(Env) env;
-    PTR(Cont) rest;
-
-    RightThenCompCont(PTR(Expr) rhs, PTR(Env) env, PTR(Cont) rest);
-    void step_continue();
-};
-
-class CompCont : public Cont {
-public:
-    PTR(Val) lhs_val;
-    PTR(Cont) rest;
-
-    CompCont(PTR(Val) lhs_val, PTR(Cont) rest);
-    void step_continue();
-};
-
@@ -2,16 +2,191 @@
 // Created by Austin Cunliffe on 1/21/20.
 //
 #include "catch.hpp"
+#include "teardown.hpp"
 #include "Expr.hpp"
 #include "parser.hpp"
 #include "Cont.hpp"
 #include "Step.hpp"
+#include "VM.hpp"
+#include "scope.hpp"
+#include "driver.hpp"
+#include "parallel.hpp"
+#include "memo.hpp"
 
 PTR(Env) Env::empty = NEW(EmptyEnv)();
 
-NumExpr::NumExpr(int rep){
+// Free variable lists are kept sorted, so they can be merged and searched,
+// and are shared rather than copied whenever a node has the same list as a child.
+static var_list_t union_of(const var_list_t &a, const var_list_t &b) {
+    if (!a)
+        return b;
+    if (!b || a == b || std::includes(a->begin(), a->end(), b->begin(), b->end()))
+        return a;
+    if (std::includes(b->begin(), b->end(), a->begin(), a->end()))
+        return b;
+    std::vector<Symbol> vars;
+    std::set_union(a->begin(), a->end(), b->begin(), b->end(), std::back_inserter(vars));
+    return std::make_shared<const std::vector<Symbol>>(std::move(vars));
+}
+
+static var_list_t without(const var_list_t &vars, const Symbol &var) {
+    if (!vars || !std::binary_search(vars->begin(), vars->end(), var))
+        return vars;
+    if (vars->size() == 1)
+        return nullptr;
+    std::vector<Symbol> rest;
+    for (const Symbol &v : *vars)
+        if (v != var)
+            rest.push_back(v);
+    return std::make_shared<const std::vector<Symbol>>(std::move(rest));
+}
+
+PTR(Val) Expr::interp_trampoline(PTR(Env) env) {
+    MemoCache::chain_t chain;
+    PTR(Expr) next;
+    ForkJoin::check_cancelled();
+    PTR(Val) val = interp_tail(env, next);
+    while (val == nullptr) {
+        ForkJoin::check_cancelled();
+        // Keep the Expr being evaluated alive while next is replaced.
+        PTR(Expr) e = std::move(next);
+        val = e->interp_tail(env, next);
+    }
+    chain.finish(val);
+    return val;
+}
+
+compiled_tail_t Expr::compile_tail_closure() {
+    return [code = compile_closure()](const PTR(FrameEnv) &frame, PTR(Val) &next, PTR(FrameEnv) &next_frame) {
+        return code(frame);
+    };
+}
+
+PTR(Expr) Expr::resolve(Scope &scope) {
+    Resolver resolver(scope);
+    return resolver.run(THIS);
+}
+
+PTR(Expr) Expr::optimize() {
+    Optimizer optimizer;
+    return optimizer.run(THIS);
+}
+
+std::string Expr::expr_print() {
+    Printer printer;
+    printer.run(THIS);
+    return printer.out;
+}
+
+PTR(Expr) Optimizer::run(PTR(Expr) e) {
+    visit(e);
+    while (!frames.empty()) {
+        // The frame keeps the node alive, even if the node pushes more
+        // frames and the vector moves it.
+        Expr *expr = &*frames.back().expr;
+        int stage = frames.back().stage++;
+        if (expr->optimize_step(*this, stage))
+            frames.pop_back();
+    }
+    return take();
+}
+
+void Optimizer::visit(PTR(Expr) e) {
+    frames.push_back({std::move(e), 0});
+}
+
+PTR(Expr) Optimizer::take() {
+    PTR(Expr) e = std::move(results.back());
+    results.pop_back();
+    return e;
+}
+
+void Optimizer::give(PTR(Expr) e) {
+    results.push_back(std::move(e));
+}
+
+void Optimizer::finish(Expr *e, PTR(Expr) optimized) {
+    if (closed == 0)
+        e->cached().optimized = optimized;
+    else
+        scopes.back()[e] = optimized;
+    give(std::move(optimized));
+}
+
+bool Optimizer::recall(Expr *e) {
+    PTR(Expr) optimized;
+    if (closed == 0) {
+        if (e->cache != nullptr)
+            optimized = e->cache->optimized;
+    } else {
+        auto found = scopes.back().find(e);
+        if (found != scopes.back().end())
+            optimized = found->second;
+    }
+    if (optimized == nullptr)
+        return false;
+    give(std::move(optimized));
+    return true;
+}
+
+void Optimizer::bind(const Symbol &name, PTR(Expr) e) {
+    // A name left a variable only needs binding when it would hide a closed binding.
+    if (e == nullptr && closed == 0)
+        return;
+    if (e != nullptr)
+        closed++;
+    bindings[name].push_back(std::move(e));
+    scopes.emplace_back();
+}
+
+void Optimizer::unbind(const Symbol &name) {
+    // The count is back to what it was at the matching bind, so it was skipped there if it is 0 here.
+    if (closed == 0)
+        return;
+    std::vector<PTR(Expr)> &bound = bindings[name];
+    if (bound.back() != nullptr)
+        closed--;
+    bound.pop_back();
+    scopes.pop_back();
+}
+
+PTR(Expr) Optimizer::lookup(const Symbol &name) {
+    if (closed == 0)
+        return nullptr;
+    auto found = bindings.find(name);
+    if (found == bindings.end() || found->second.empty())
+        return nullptr;
+    return found->second.back();
+}
+
+void Printer::run(PTR(Expr) e) {
+    visit(e);
+    while (!frames.empty()) {
+        Expr *expr = &*frames.back().expr;
+        int stage = frames.back().stage++;
+        if (expr->print_step(*this, stage))
+            frames.pop_back();
+    }
+}
+
+void Printer::visit(PTR(Expr) e) {
+    frames.push_back({std::move(e), 0});
+}
+
+Expr::~Expr() {
+    if (cache != nullptr)
+        Teardown::release(cache->optimized);
+}
+
+NumExpr::NumExpr(int64_t rep){
     this->rep = rep;
-    this->val = NEW(NumVal)(rep);
+    this->val = NumVal::make(rep);
+}
+
+NumExpr::NumExpr(const BigInt &rep) {
+    this->val = BigNumVal::make(rep);
+    if (!rep.to_int64(this->rep))
+        this->rep = 0;
 }
 
 bool NumExpr::equals(PTR(Expr) e) {
@@ -19,42 +194,69 @@ bool NumExpr::equals(PTR(Expr) e) {
     if (n == NULL)
         return false;
     else
-        return rep == n->rep;
+        return val->equals(n->val);
 }
 
 PTR(Val) NumExpr::interp(PTR(Env) env) {
     return val;
 }
 
-void NumExpr::step_interp() {
-    Step::mode = Step::continue_mode;
-    Step::val = NEW(NumVal)(rep);
-    Step::cont = Step::cont;
+void NumExpr::step_interp(Step &step) {
+    step.mode = Step::continue_mode;
+    step.val = val;
 }
 
+void NumExpr::compile(Bytecode &code) {
+    code.emit(Bytecode::op_const, code.add_constant(val));
+}
 
-PTR(Expr) NumExpr::subst(std::string var, PTR(Val) val) {
-    return NEW(NumExpr)(this->rep);
+compiled_t NumExpr::compile_closure() {
+    PTR(Val) val = this->val;
+    return [val](const PTR(FrameEnv) &frame) {
+        return val;
+    };
 }
 
-bool NumExpr::contains_var(){
-    return false;
+bool NumExpr::resolve_step(Resolver &resolver, int stage) {
+    resolver.give(THIS);
+    return true;
 }
 
-PTR(Expr) NumExpr::optimize(){
-    return NEW(NumExpr)(rep);
+
+PTR(Expr) NumExpr::subst(const Symbol &var, PTR(Val) val) {
+    return THIS;
+}
+
+var_list_t NumExpr::find_free_vars() {
+    return nullptr;
 }
 
-std::string NumExpr::expr_print() {
-    return std::to_string(rep);
+bool NumExpr::optimize_step(Optimizer &optimizer, int stage) {
+    optimizer.give(THIS);
+    return true;
+}
+
+bool NumExpr::print_step(Printer &printer, int stage) {
+    printer.out += val->to_string();
+    return true;
 }
 
 AddExpr::AddExpr(PTR(Expr) lhs, PTR(Expr) rhs) {
     this->lhs = lhs;
     this->rhs = rhs;
+    this->has_var = lhs->has_var || rhs->has_var;
+    this->has_call = lhs->has_call || rhs->has_call;
+    this->size = 1 + lhs->size + rhs->size;
+}
+
+AddExpr::~AddExpr() {
+    Teardown::release(lhs);
+    Teardown::release(rhs);
 }
 
 bool AddExpr::equals(PTR(Expr) e) {
+    if (identity_decides(e))
+        return &*e == this;
     PTR(AddExpr) a = CAST(AddExpr)(e);
     if (a == NULL)
         return false;
@@ -64,50 +266,110 @@ bool AddExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) AddExpr::interp(PTR(Env) env) {
-    return lhs->interp(env)->add_to(rhs->interp(env));
+    PTR(Val) lhs_val, rhs_val;
+    ForkJoin::interp_pair(lhs, rhs, env, lhs_val, rhs_val);
+    return Val::add(lhs_val, rhs_val);
 }
 
-void AddExpr::step_interp() {
-    Step::mode = Step::interp_mode;
-    Step::expr = lhs;
-    Step::env = Step::env;
-    Step::cont = NEW(RightThenAddCont)(rhs, Step::env, Step::cont);
+void AddExpr::step_interp(Step &step) {
+    step.conts.push_back(Cont(Cont::right_then_add, rhs, step.env));
+    step.mode = Step::interp_mode;
+    step.expr = lhs;
 }
 
-PTR(Expr) AddExpr::subst(std::string var, PTR(Val) val) {
-    return NEW(AddExpr)(lhs->subst(var, val), rhs->subst(var, val));
+void AddExpr::compile(Bytecode &code) {
+    lhs->compile(code);
+    rhs->compile(code);
+    code.emit(Bytecode::op_add);
 }
 
-bool AddExpr::contains_var(){
-    return lhs->contains_var() || rhs->contains_var();
+compiled_t AddExpr::compile_closure() {
+    compiled_t lhs_code = lhs->compile_closure();
+    compiled_t rhs_code = rhs->compile_closure();
+    return [lhs_code = std::move(lhs_code), rhs_code = std::move(rhs_code)](const PTR(FrameEnv) &frame) {
+        PTR(Val) lhs_val = lhs_code(frame);
+        return Val::add(lhs_val, rhs_code(frame));
+    };
 }
 
-PTR(Expr) AddExpr::optimize() {
-    if (this->contains_var()) {
-        PTR(Expr) e = (NEW(AddExpr)(lhs->optimize(), rhs->optimize()));
-        if (!e->contains_var()) {
-            return e->interp(Env::empty)->to_expr();
-        } else {
-            return e;
-        }
+bool AddExpr::resolve_step(Resolver &resolver, int stage) {
+    if (stage == 0) {
+        resolver.visit(lhs);
+        return false;
+    }
+    if (stage == 1) {
+        resolver.visit(rhs);
+        return false;
     }
-    return THIS->interp(Env::empty)->to_expr();
+    PTR(Expr) resolved_rhs = resolver.take();
+    PTR(Expr) resolved_lhs = resolver.take();
+    resolver.give(NEW(AddExpr)(resolved_lhs, resolved_rhs));
+    return true;
 }
 
-std::string AddExpr::expr_print() {
-    std::string left = lhs->expr_print();
-    std::string right = rhs->expr_print();
+PTR(Expr) AddExpr::subst(const Symbol &var, PTR(Val) val) {
+    if (!has_free_var(var))
+        return THIS;
+    return NEW(AddExpr)(lhs->subst(var, val), rhs->subst(var, val));
+}
+
+var_list_t AddExpr::find_free_vars() {
+    return union_of(lhs->free_vars(), rhs->free_vars());
+}
+
+
+bool AddExpr::optimize_step(Optimizer &optimizer, int stage) {
+    if (stage == 0) {
+        if (optimizer.recall(this))
+            return true;
+        optimizer.visit(lhs);
+        return false;
+    }
+    if (stage == 1) {
+        optimizer.visit(rhs);
+        return false;
+    }
+    // Closed operands have already been folded, so interpreting this node does not recurse far.
+    PTR(Expr) optimized_rhs = optimizer.take();
+    PTR(Expr) optimized_lhs = optimizer.take();
+    PTR(Expr) e = NEW(AddExpr)(optimized_lhs, optimized_rhs);
+    if (!e->contains_var())
+        e = e->interp(Env::empty)->to_expr();
+    optimizer.finish(this, e);
+    return true;
+}
 
-    std::string output = "(" + left + " + " + right + ")";
-    return output;
+bool AddExpr::print_step(Printer &printer, int stage) {
+    switch (stage) {
+        case 0:
+            printer.out += "(";
+            printer.visit(lhs);
+            return false;
+        case 1:
+            printer.out += " + ";
+            printer.visit(rhs);
+            return false;
+    }
+    printer.out += ")";
+    return true;
 }
 
 MultExpr::MultExpr(PTR(Expr)lhs, PTR(Expr)rhs) {
     this->lhs = lhs;
     this->rhs = rhs;
+    this->has_var = lhs->has_var || rhs->has_var;
+    this->has_call = lhs->has_call || rhs->has_call;
+    this->size = 1 + lhs->size + rhs->size;
+}
+
+MultExpr::~MultExpr() {
+    Teardown::release(lhs);
+    Teardown::release(rhs);
 }
 
 bool MultExpr::equals(PTR(Expr)e) {
+    if (identity_decides(e))
+        return &*e == this;
     PTR(MultExpr) m = CAST(MultExpr)(e);
     if (m == NULL)
         return false;
@@ -117,46 +379,109 @@ bool MultExpr::equals(PTR(Expr)e) {
 }
 
 PTR(Val) MultExpr::interp(PTR(Env) env) {
-    return lhs->interp(env)->mult_with(rhs->interp(env));
+    PTR(Val) lhs_val, rhs_val;
+    ForkJoin::interp_pair(lhs, rhs, env, lhs_val, rhs_val);
+    return Val::mult(lhs_val, rhs_val);
 }
 
-void MultExpr::step_interp() {
-    Step::mode = Step::interp_mode;
-    Step::expr = lhs;
-    Step::env = Step::env;
-    Step::cont = NEW(RightThenMultCont)(rhs, Step::env, Step::cont);
+void MultExpr::step_interp(Step &step) {
+    step.conts.push_back(Cont(Cont::right_then_mult, rhs, step.env));
+    step.mode = Step::interp_mode;
+    step.expr = lhs;
 }
 
-PTR(Expr) MultExpr::subst(std::string var, PTR(Val) val) {
-    return NEW(MultExpr)(lhs->subst(var, val), rhs->subst(var, val));
+void MultExpr::compile(Bytecode &code) {
+    lhs->compile(code);
+    rhs->compile(code);
+    code.emit(Bytecode::op_mult);
 }
 
-bool MultExpr::contains_var(){
-    return lhs->contains_var() || rhs->contains_var();
+compiled_t MultExpr::compile_closure() {
+    compiled_t lhs_code = lhs->compile_closure();
+    compiled_t rhs_code = rhs->compile_closure();
+    return [lhs_code = std::move(lhs_code), rhs_code = std::move(rhs_code)](const PTR(FrameEnv) &frame) {
+        PTR(Val) lhs_val = lhs_code(frame);
+        return Val::mult(lhs_val, rhs_code(frame));
+    };
 }
 
-PTR(Expr) MultExpr::optimize() {
-    if (this->contains_var()) {
-        PTR(MultExpr) e = (NEW(MultExpr)(lhs->optimize(), rhs->optimize()));
-        if (!e->contains_var()) {
-            return e->optimize();
-        } else {
-            return e;
-        }
+bool MultExpr::resolve_step(Resolver &resolver, int stage) {
+    if (stage == 0) {
+        resolver.visit(lhs);
+        return false;
     }
-    return THIS->interp(Env::empty)->to_expr();
+    if (stage == 1) {
+        resolver.visit(rhs);
+        return false;
+    }
+    PTR(Expr) resolved_rhs = resolver.take();
+    PTR(Expr) resolved_lhs = resolver.take();
+    resolver.give(NEW(MultExpr)(resolved_lhs, resolved_rhs));
+    return true;
 }
 
-std::string MultExpr::expr_print() {
-    std::string left = lhs->expr_print();
-    std::string right = rhs->expr_print();
+PTR(Expr) MultExpr::subst(const Symbol &var, PTR(Val) val) {
+    if (!has_free_var(var))
+        return THIS;
+    return NEW(MultExpr)(lhs->subst(var, val), rhs->subst(var, val));
+}
 
-    std::string output = "(" + left + " * " + right + ")";
-    return output;
+var_list_t MultExpr::find_free_vars() {
+    return union_of(lhs->free_vars(), rhs->free_vars());
 }
 
-VarExpr::VarExpr(std::string name) {
+
+bool MultExpr::optimize_step(Optimizer &optimizer, int stage) {
+    if (stage == 0) {
+        if (optimizer.recall(this))
+            return true;
+        optimizer.visit(lhs);
+        return false;
+    }
+    if (stage == 1) {
+        optimizer.visit(rhs);
+        return false;
+    }
+    // Closed operands have already been folded, so interpreting this node does not recurse far.
+    PTR(Expr) optimized_rhs = optimizer.take();
+    PTR(Expr) optimized_lhs = optimizer.take();
+    PTR(Expr) e = NEW(MultExpr)(optimized_lhs, optimized_rhs);
+    if (!e->contains_var())
+        e = e->interp(Env::empty)->to_expr();
+    optimizer.finish(this, e);
+    return true;
+}
+
+bool MultExpr::print_step(Printer &printer, int stage) {
+    switch (stage) {
+        case 0:
+            printer.out += "(";
+            printer.visit(lhs);
+            return false;
+        case 1:
+            printer.out += " * ";
+            printer.visit(rhs);
+            return false;
+    }
+    printer.out += ")";
+    return true;
+}
+
+VarExpr::VarExpr(const Symbol &name) {
     this->name = name;
+    name.hold();
+    this->depth = -1;
+    this->slot = -1;
+    this->has_var = true;
+}
+
+VarExpr::VarExpr(const Symbol &name, int depth, int slot) : VarExpr(name) {
+    this->depth = depth;
+    this->slot = slot;
+}
+
+VarExpr::~VarExpr() {
+    name.drop();
 }
 
 bool VarExpr::equals(PTR(Expr)e) {
@@ -168,41 +493,96 @@ bool VarExpr::equals(PTR(Expr)e) {
 }
 
 PTR(Val) VarExpr::interp(PTR(Env) env) {
-    return env->lookup(name);
+    if (depth < 0)
+        return env->lookup(name);
+    return env->lookup(depth, slot);
+}
+
+void VarExpr::step_interp(Step &step) {
+    step.mode = Step::continue_mode;
+    if (depth < 0)
+        step.val = step.env->lookup(name);
+    else
+        step.val = step.env->lookup(depth, slot);
 }
 
-void VarExpr::step_interp() {
-    Step::mode = Step::continue_mode;
-    Step::val = Step::env->lookup(name);
-    Step::cont = Step::cont;
+void VarExpr::compile(Bytecode &code) {
+    code.emit(Bytecode::op_load, code.add_name(name));
 }
 
-PTR(Expr) VarExpr::subst(std::string var, PTR(Val) val) {
+compiled_t VarExpr::compile_closure() {
+    Symbol name = this->name;
+    int depth = this->depth;
+    int slot = this->slot;
+    if (depth < 0) {
+        return [name](const PTR(FrameEnv) &frame) {
+            return Env::empty->lookup(name);
+        };
+    }
+    // Every frame a compiled function can see was made by compiled code.
+    return [depth, slot](const PTR(FrameEnv) &frame) {
+        FrameEnv *f = &*frame;
+        for (int i = 0; i < depth; i++)
+            f = static_cast<FrameEnv *>(&*f->rest);
+        return f->slots[slot];
+    };
+}
+
+bool VarExpr::resolve_step(Resolver &resolver, int stage) {
+    int depth, slot;
+    if (resolver.scope->find(name, depth, slot))
+        resolver.give(NEW(VarExpr)(name, depth, slot));
+    else
+        resolver.give(NEW(VarExpr)(name));
+    return true;
+}
+
+PTR(Expr) VarExpr::subst(const Symbol &var, PTR(Val) val) {
     if (var == name)
         return val->to_expr();
     else
-        return NEW(VarExpr)(name);
+        return THIS;
 }
 
-bool VarExpr::contains_var(){
-    return true;
+var_list_t VarExpr::find_free_vars() {
+    return std::make_shared<const std::vector<Symbol>>(1, name);
 }
 
-PTR(Expr) VarExpr::optimize() {
-    return NEW(VarExpr)(name);
+bool VarExpr::optimize_step(Optimizer &optimizer, int stage) {
+    PTR(Expr) bound = optimizer.lookup(name);
+    optimizer.give(bound != nullptr ? bound : THIS);
+    return true;
 }
 
-std::string VarExpr::expr_print() {
-    return name;
+bool VarExpr::print_step(Printer &printer, int stage) {
+    printer.out += name.str();
+    return true;
 }
 
-LetExpr::LetExpr(std::string name, PTR(Expr) var_val, PTR(Expr) in_expr) {
+LetExpr::LetExpr(const Symbol &name, PTR(Expr) var_val, PTR(Expr) in_expr) {
     this->name = name;
+    name.hold();
     this->var_val = var_val;
     this->in_expr = in_expr;
+    this->slot = -1;
+    this->has_var = in_expr->has_var;
+    this->has_call = var_val->has_call || in_expr->has_call;
+    this->size = 1 + var_val->size + in_expr->size;
+}
+
+LetExpr::LetExpr(const Symbol &name, PTR(Expr) var_val, PTR(Expr) in_expr, int slot) : LetExpr(name, var_val, in_expr) {
+    this->slot = slot;
+}
+
+LetExpr::~LetExpr() {
+    name.drop();
+    Teardown::release(var_val);
+    Teardown::release(in_expr);
 }
 
 bool LetExpr::equals(PTR(Expr)e) {
+    if (identity_decides(e))
+        return &*e == this;
     PTR(LetExpr) l = CAST(LetExpr)(e);
     if (l == NULL)
         return false;
@@ -211,19 +591,74 @@ bool LetExpr::equals(PTR(Expr)e) {
 }
 
 PTR(Val) LetExpr::interp(PTR(Env) env) {
+    return interp_trampoline(env);
+}
+
+PTR(Val) LetExpr::interp_tail(PTR(Env) &env, PTR(Expr) &next) {
     PTR(Val) rhs_val = var_val->interp(env);
-    PTR(Env) new_env = NEW(ExtendedEnv)(env, name, rhs_val);
-    return in_expr->interp(new_env);
+    if (slot >= 0)
+        env->bind(slot, rhs_val);
+    else
+        env = NEW(ExtendedEnv)(env, name, rhs_val);
+    next = in_expr;
+    return nullptr;
+}
+
+void LetExpr::step_interp(Step &step) {
+    step.conts.push_back(Cont(name, slot, in_expr, step.env));
+    step.mode = Step::interp_mode;
+    step.expr = var_val;
 }
 
-void LetExpr::step_interp() {
-    Step::mode = Step::interp_mode;
-    Step::expr = var_val;
-    Step::env = Step::env;
-    Step::cont = NEW(LetBodyCont)(name, in_expr, Step::env, Step::cont);
+void LetExpr::compile(Bytecode &code) {
+    var_val->compile(code);
+    code.emit(Bytecode::op_bind, code.add_name(name));
+    in_expr->compile(code);
+    code.emit(Bytecode::op_unbind);
 }
 
-PTR(Expr) LetExpr::subst(std::string var, PTR(Val) val) {
+compiled_t LetExpr::compile_closure() {
+    compiled_t val_code = var_val->compile_closure();
+    compiled_t body_code = in_expr->compile_closure();
+    int slot = this->slot;
+    return [val_code = std::move(val_code), body_code = std::move(body_code), slot](const PTR(FrameEnv) &frame) {
+        frame->slots[slot] = val_code(frame);
+        return body_code(frame);
+    };
+}
+
+compiled_tail_t LetExpr::compile_tail_closure() {
+    compiled_t val_code = var_val->compile_closure();
+    compiled_tail_t body_code = in_expr->compile_tail_closure();
+    int slot = this->slot;
+    return [val_code = std::move(val_code), body_code = std::move(body_code),
+            slot](const PTR(FrameEnv) &frame, PTR(Val) &next, PTR(FrameEnv) &next_frame) {
+        frame->slots[slot] = val_code(frame);
+        return body_code(frame, next, next_frame);
+    };
+}
+
+bool LetExpr::resolve_step(Resolver &resolver, int stage) {
+    if (stage == 0) {
+        resolver.visit(var_val);
+        return false;
+    }
+    if (stage == 1) {
+        resolver.scope->bind(name);
+        resolver.visit(in_expr);
+        return false;
+    }
+    int slot = resolver.scope->bindings.back().second;
+    resolver.scope->unbind();
+    PTR(Expr) resolved_body = resolver.take();
+    PTR(Expr) resolved_val = resolver.take();
+    resolver.give(NEW(LetExpr)(name, resolved_val, resolved_body, slot));
+    return true;
+}
+
+PTR(Expr) LetExpr::subst(const Symbol &var, PTR(Val) val) {
+    if (!has_free_var(var))
+        return THIS;
     if (var == name) {
         return NEW(LetExpr)(name, var_val->subst(var, val), in_expr);
     }
@@ -232,24 +667,48 @@ PTR(Expr) LetExpr::subst(std::string var, PTR(Val) val) {
     }
 }
 
-bool LetExpr::contains_var(){
-    return in_expr->contains_var();
+var_list_t LetExpr::find_free_vars() {
+    return union_of(var_val->free_vars(), without(in_expr->free_vars(), name));
 }
 
-PTR(Expr) LetExpr::optimize() {
-    var_val = var_val->optimize();
-    if (!(var_val->contains_var()))
-        return in_expr->subst(name, var_val->interp(Env::empty))->optimize();
-    return NEW(LetExpr)(name, var_val, in_expr->optimize());
+bool LetExpr::optimize_step(Optimizer &optimizer, int stage) {
+    if (stage == 0) {
+        if (optimizer.recall(this))
+            return true;
+        optimizer.visit(var_val);
+        return false;
+    }
+    if (stage == 1) {
+        PTR(Expr) optimized_val = optimizer.results.back();
+        if (!(optimized_val->contains_var()))
+            optimizer.bind(name, optimized_val->interp(Env::empty)->to_expr());
+        else
+            optimizer.bind(name, nullptr);
+        optimizer.visit(in_expr);
+        return false;
+    }
+    optimizer.unbind(name);
+    PTR(Expr) optimized_body = optimizer.take();
+    PTR(Expr) optimized_val = optimizer.take();
+    if (!(optimized_val->contains_var()))
+        optimizer.finish(this, optimized_body);
+    else
+        optimizer.finish(this, NEW(LetExpr)(name, optimized_val, optimized_body));
+    return true;
 }
 
-std::string LetExpr::expr_print() {
-    std::string output = "_let " + name;
-    std::string variable_val = var_val->expr_print();
-    std::string body = in_expr->expr_print();
-
-    output = output + " = " + variable_val + " _in " + body;
-    return output;
+bool LetExpr::print_step(Printer &printer, int stage) {
+    switch (stage) {
+        case 0:
+            printer.out += "_let " + name.str() + " = ";
+            printer.visit(var_val);
+            return false;
+        case 1:
+            printer.out += " _in ";
+            printer.visit(in_expr);
+            return false;
+    }
+    return true;
 }
 
 BoolExpr::BoolExpr(bool rep) {
@@ -265,39 +724,66 @@ bool BoolExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) BoolExpr::interp(PTR(Env) env) {
-    return NEW(BoolVal)(rep);
+    return BoolVal::make(rep);
+}
+
+void BoolExpr::step_interp(Step &step) {
+    step.mode = Step::continue_mode;
+    step.val = BoolVal::make(rep);
+}
+
+void BoolExpr::compile(Bytecode &code) {
+    code.emit(Bytecode::op_const, code.add_constant(BoolVal::make(rep)));
+}
+
+compiled_t BoolExpr::compile_closure() {
+    PTR(Val) val = BoolVal::make(rep);
+    return [val](const PTR(FrameEnv) &frame) {
+        return val;
+    };
 }
 
-void BoolExpr::step_interp() {
-    Step::mode = Step::continue_mode;
-    Step::val = NEW(BoolVal)(rep);
-    Step::cont = Step::cont;
+bool BoolExpr::resolve_step(Resolver &resolver, int stage) {
+    resolver.give(THIS);
+    return true;
 }
 
-PTR(Expr) BoolExpr::subst(std::string var, PTR(Val) new_val) {
-    return NEW(BoolExpr)(rep);
+PTR(Expr) BoolExpr::subst(const Symbol &var, PTR(Val) new_val) {
+    return THIS;
 }
 
-bool BoolExpr::contains_var() {
-    return false;
+var_list_t BoolExpr::find_free_vars() {
+    return nullptr;
 }
 
-PTR(Expr) BoolExpr::optimize() {
-    return NEW(BoolExpr)(rep);
+bool BoolExpr::optimize_step(Optimizer &optimizer, int stage) {
+    optimizer.give(THIS);
+    return true;
 }
 
-std::string BoolExpr::expr_print() {
-    if (this->rep) return "_true";
-    return "_false";
+bool BoolExpr::print_step(Printer &printer, int stage) {
+    printer.out += this->rep ? "_true" : "_false";
+    return true;
 }
 
 IfExpr::IfExpr(PTR(Expr) test_part, PTR(Expr) then_part, PTR(Expr) else_part) {
     this->test_part = test_part;
     this->then_part = then_part;
     this->else_part = else_part;
+    this->has_var = test_part->has_var || then_part->has_var || else_part->has_var;
+    this->has_call = test_part->has_call || then_part->has_call || else_part->has_call;
+    this->size = 1 + test_part->size + then_part->size + else_part->size;
+}
+
+IfExpr::~IfExpr() {
+    Teardown::release(test_part);
+    Teardown::release(then_part);
+    Teardown::release(else_part);
 }
 
 bool IfExpr::equals(PTR(Expr) e) {
+    if (identity_decides(e))
+        return &*e == this;
     PTR(IfExpr) i = CAST(IfExpr)(e);
     if (i == NULL)
         return false;
@@ -307,48 +793,156 @@ bool IfExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) IfExpr::interp(PTR(Env) env) {
-    if (test_part->interp(env)->is_true())
-        return then_part->interp(env);
-    else
-        return else_part->interp(env);
+    return interp_trampoline(env);
 }
 
-void IfExpr::step_interp() {
-    Step::mode = Step::interp_mode;
-    Step::expr = test_part;
-    Step::env = Step::env;
-    Step::cont = NEW(IfBranchCont)(then_part, else_part, Step::env, Step::cont);
+PTR(Val) IfExpr::interp_tail(PTR(Env) &env, PTR(Expr) &next) {
+    if (test_part->interp(env)->is_true())
+        next = then_part;
+    else
+        next = else_part;
+    return nullptr;
+}
+
+void IfExpr::step_interp(Step &step) {
+    step.conts.push_back(Cont(then_part, else_part, step.env));
+    step.mode = Step::interp_mode;
+    step.expr = test_part;
+}
+
+void IfExpr::compile(Bytecode &code) {
+    test_part->compile(code);
+    int to_else = code.emit(Bytecode::op_jump_if_false);
+    then_part->compile(code);
+    int to_end = code.emit(Bytecode::op_jump);
+    code.code[to_else].arg = (int) code.code.size();
+    else_part->compile(code);
+    code.code[to_end].arg = (int) code.code.size();
+}
+
+compiled_t IfExpr::compile_closure() {
+    compiled_t test_code = test_part->compile_closure();
+    compiled_t then_code = then_part->compile_closure();
+    compiled_t else_code = else_part->compile_closure();
+    return [test_code = std::move(test_code), then_code = std::move(then_code),
+            else_code = std::move(else_code)](const PTR(FrameEnv) &frame) {
+        if (test_code(frame)->is_true())
+            return then_code(frame);
+        else
+            return else_code(frame);
+    };
+}
+
+compiled_tail_t IfExpr::compile_tail_closure() {
+    compiled_t test_code = test_part->compile_closure();
+    compiled_tail_t then_code = then_part->compile_tail_closure();
+    compiled_tail_t else_code = else_part->compile_tail_closure();
+    return [test_code = std::move(test_code), then_code = std::move(then_code), else_code = std::move(else_code)](
+            const PTR(FrameEnv) &frame, PTR(Val) &next, PTR(FrameEnv) &next_frame) {
+        if (test_code(frame)->is_true())
+            return then_code(frame, next, next_frame);
+        else
+            return else_code(frame, next, next_frame);
+    };
+}
+
+bool IfExpr::resolve_step(Resolver &resolver, int stage) {
+    switch (stage) {
+        case 0:
+            resolver.visit(test_part);
+            return false;
+        case 1:
+            resolver.visit(then_part);
+            return false;
+        case 2:
+            resolver.visit(else_part);
+            return false;
+    }
+    PTR(Expr) resolved_else = resolver.take();
+    PTR(Expr) resolved_then = resolver.take();
+    PTR(Expr) resolved_test = resolver.take();
+    resolver.give(NEW(IfExpr)(resolved_test, resolved_then, resolved_else));
+    return true;
 }
 
-PTR(Expr) IfExpr::subst(std::string var, PTR(Val) val) {
+PTR(Expr) IfExpr::subst(const Symbol &var, PTR(Val) val) {
+    if (!has_free_var(var))
+        return THIS;
     return NEW(IfExpr)(test_part->subst(var, val), then_part->subst(var, val),
             else_part->subst(var, val));
 }
 
-bool IfExpr::contains_var() {
-    return test_part->contains_var() || then_part->contains_var() || else_part->contains_var();
+var_list_t IfExpr::find_free_vars() {
+    return union_of(test_part->free_vars(), union_of(then_part->free_vars(), else_part->free_vars()));
 }
 
-PTR(Expr) IfExpr::optimize() {
-    if (!test_part->contains_var()) {
-        if (test_part->interp(Env::empty)->is_true())
-            return then_part->optimize();
+bool IfExpr::optimize_step(Optimizer &optimizer, int stage) {
+    if (stage == 0) {
+        if (optimizer.recall(this))
+            return true;
+        optimizer.visit(test_part);
+        return false;
+    }
+    // The optimized test stays on the results under the branches, and decides whether there is one or two.
+    if (stage == 1) {
+        PTR(Expr) optimized_test = optimizer.results.back();
+        if (!optimized_test->contains_var() && !optimized_test->interp(Env::empty)->is_true())
+            optimizer.visit(else_part);
         else
-            return else_part->optimize();
+            optimizer.visit(then_part);
+        return false;
+    }
+    if (stage == 2) {
+        if (optimizer.results[optimizer.results.size() - 2]->contains_var()) {
+            optimizer.visit(else_part);
+            return false;
+        }
+        PTR(Expr) optimized_branch = optimizer.take();
+        optimizer.take();
+        optimizer.finish(this, optimized_branch);
+        return true;
     }
-    return NEW(IfExpr)(test_part->optimize(), then_part->optimize(), else_part->optimize());
+    PTR(Expr) optimized_else = optimizer.take();
+    PTR(Expr) optimized_then = optimizer.take();
+    PTR(Expr) optimized_test = optimizer.take();
+    optimizer.finish(this, NEW(IfExpr)(optimized_test, optimized_then, optimized_else));
+    return true;
 }
 
-std::string IfExpr::expr_print() {
-    return "_if " + test_part->expr_print() + " _then " + then_part->expr_print() + " _else " + else_part->expr_print();
+bool IfExpr::print_step(Printer &printer, int stage) {
+    switch (stage) {
+        case 0:
+            printer.out += "_if ";
+            printer.visit(test_part);
+            return false;
+        case 1:
+            printer.out += " _then ";
+            printer.visit(then_part);
+            return false;
+        case 2:
+            printer.out += " _else ";
+            printer.visit(else_part);
+            return false;
+    }
+    return true;
 }
 
 EqualExpr::EqualExpr(PTR(Expr) lhs, PTR(Expr) rhs) {
     this->lhs = lhs;
     this->rhs = rhs;
+    this->has_var = lhs->has_var || rhs->has_var;
+    this->has_call = lhs->has_call || rhs->has_call;
+    this->size = 1 + lhs->size + rhs->size;
+}
+
+EqualExpr::~EqualExpr() {
+    Teardown::release(lhs);
+    Teardown::release(rhs);
 }
 
 bool EqualExpr::equals(PTR(Expr) e) {
+    if (identity_decides(e))
+        return &*e == this;
     PTR(EqualExpr) eq = CAST(EqualExpr)(e);
     if (eq == NULL)
         return false;
@@ -357,112 +951,453 @@ bool EqualExpr::equals(PTR(Expr) e) {
 }
 
 PTR(Val) EqualExpr::interp(PTR(Env) env) {
-    return NEW(BoolVal)(lhs->interp(env)->equals(rhs->interp(env)));
+    PTR(Val) lhs_val, rhs_val;
+    ForkJoin::interp_pair(lhs, rhs, env, lhs_val, rhs_val);
+    return BoolVal::make(lhs_val->equals(rhs_val));
+}
+
+void EqualExpr::step_interp(Step &step) {
+    step.conts.push_back(Cont(Cont::right_then_comp, rhs, step.env));
+    step.mode = Step::interp_mode;
+    step.expr = lhs;
 }
 
-void EqualExpr::step_interp() {
-    Step::mode = Step::interp_mode;
-    Step::expr = lhs;
-    Step::env = Step::env;
-    Step::cont = NEW(RightThenCompCont)(rhs, Step::env, Step::cont);
+void EqualExpr::compile(Bytecode &code) {
+    lhs->compile(code);
+    rhs->compile(code);
+    code.emit(Bytecode::op_equal);
 }
 
-PTR(Expr) EqualExpr::subst(std::string var, PTR(Val) val) {
+compiled_t EqualExpr::compile_closure() {
+    compiled_t lhs_code = lhs->compile_closure();
+    compiled_t rhs_code = rhs->compile_closure();
+    return [lhs_code = std::move(lhs_code), rhs_code = std::move(rhs_code)](const PTR(FrameEnv) &frame) {
+        PTR(Val) lhs_val = lhs_code(frame);
+        return BoolVal::make(lhs_val->equals(rhs_code(frame)));
+    };
+}
+
+bool EqualExpr::resolve_step(Resolver &resolver, int stage) {
+    if (stage == 0) {
+        resolver.visit(lhs);
+        return false;
+    }
+    if (stage == 1) {
+        resolver.visit(rhs);
+        return false;
+    }
+    PTR(Expr) resolved_rhs = resolver.take();
+    PTR(Expr) resolved_lhs = resolver.take();
+    resolver.give(NEW(EqualExpr)(resolved_lhs, resolved_rhs));
+    return true;
+}
+
+PTR(Expr) EqualExpr::subst(const Symbol &var, PTR(Val) val) {
+    if (!has_free_var(var))
+        return THIS;
     return NEW(EqualExpr)(lhs->subst(var, val), rhs->subst(var, val));
 }
 
-bool EqualExpr::contains_var() {
-    return lhs->contains_var() || rhs->contains_var();
+var_list_t EqualExpr::find_free_vars() {
+    return union_of(lhs->free_vars(), rhs->free_vars());
 }
 
-PTR(Expr) EqualExpr::optimize() {
-    if (!(this->contains_var())) {
-        return NEW(BoolExpr)(lhs->optimize()->equals(rhs->optimize()));
+
+bool EqualExpr::optimize_step(Optimizer &optimizer, int stage) {
+    if (stage == 0) {
+        if (optimizer.recall(this))
+            return true;
+        optimizer.visit(lhs);
+        return false;
     }
-    return NEW(EqualExpr)(lhs->optimize(), rhs->optimize());
+    if (stage == 1) {
+        optimizer.visit(rhs);
+        return false;
+    }
+    PTR(Expr) optimized_rhs = optimizer.take();
+    PTR(Expr) optimized_lhs = optimizer.take();
+    if (!optimized_lhs->contains_var() && !optimized_rhs->contains_var())
+        optimizer.finish(this, NEW(BoolExpr)(optimized_lhs->equals(optimized_rhs)));
+    else
+        optimizer.finish(this, NEW(EqualExpr)(optimized_lhs, optimized_rhs));
+    return true;
 }
 
-std::string EqualExpr::expr_print() {
-    return "(" + lhs->expr_print() + " == " + rhs->expr_print() + ")";
+bool EqualExpr::print_step(Printer &printer, int stage) {
+    switch (stage) {
+        case 0:
+            printer.out += "(";
+            printer.visit(lhs);
+            return false;
+        case 1:
+            printer.out += " == ";
+            printer.visit(rhs);
+            return false;
+    }
+    printer.out += ")";
+    return true;
+}
+
+FunExpr::FunExpr(const Symbol &formal_arg, PTR(Expr) actual_arg)
+        : FunExpr(std::make_shared<const std::vector<Symbol>>(1, formal_arg), actual_arg) {
 }
 
-FunExpr::FunExpr(std::string formal_arg, PTR(Expr) actual_arg) {
-    this->formal_arg = formal_arg;
+FunExpr::FunExpr(var_list_t formal_args, PTR(Expr) actual_arg) {
+    this->formal_args = formal_args;
+    for (const Symbol &formal_arg : *formal_args)
+        formal_arg.hold();
     this->actual_arg = actual_arg;
+    this->frame_size = -1;
+    this->has_var = actual_arg->has_var;
+    this->size = 1 + actual_arg->size;
+}
+
+FunExpr::FunExpr(const Symbol &self_name, var_list_t formal_args, PTR(Expr) actual_arg) : FunExpr(formal_args, actual_arg) {
+    this->self_name = self_name;
+    self_name.hold();
+}
+
+FunExpr::FunExpr(const Symbol &self_name, var_list_t formal_args, PTR(Expr) actual_arg, int frame_size)
+        : FunExpr(self_name, formal_args, actual_arg) {
+    this->frame_size = frame_size;
+}
+
+FunExpr::~FunExpr() {
+    self_name.drop();
+    for (const Symbol &formal_arg : *formal_args)
+        formal_arg.drop();
+    Teardown::release(actual_arg);
 }
 
 bool FunExpr::equals(PTR(Expr) e) {
+    if (identity_decides(e))
+        return &*e == this;
     PTR(FunExpr) f = CAST(FunExpr)(e);
     if (f == NULL)
         return false;
     else
-        return (this->formal_arg == f->formal_arg) && (this->actual_arg->equals(f->actual_arg));
+        return (this->self_name == f->self_name) && (*this->formal_args == *f->formal_args)
+               && (this->actual_arg->equals(f->actual_arg));
 }
 
 PTR(Val) FunExpr::interp(PTR(Env) env) {
-    return NEW(FunVal)(formal_arg, actual_arg, env);
+    return NEW(FunVal)(self_name, formal_args, actual_arg, env, frame_size);
+}
+
+void FunExpr::step_interp(Step &step) {
+    step.mode = Step::continue_mode;
+    step.val = NEW(FunVal)(self_name, formal_args, actual_arg, step.env, frame_size);
+}
+
+void FunExpr::compile(Bytecode &code) {
+    code.emit(Bytecode::op_closure, code.add_function(self_name, formal_args, actual_arg));
+}
+
+compiled_t FunExpr::compile_closure() {
+    std::shared_ptr<const compiled_tail_t> body_code
+            = std::make_shared<const compiled_tail_t>(actual_arg->compile_tail_closure());
+    Symbol self_name = this->self_name;
+    var_list_t formal_args = this->formal_args;
+    PTR(Expr) body = actual_arg;
+    int frame_size = this->frame_size;
+    return [self_name, formal_args, body, frame_size, body_code](const PTR(FrameEnv) &frame) -> PTR(Val) {
+        return NEW(FunVal)(self_name, formal_args, body, frame, frame_size, body_code);
+    };
+}
+
+// The arguments take the first slots of the frame, in order, and a
+// recursive function's own name the slot after them. The arguments
+// still shadow the function's name.
+bool FunExpr::resolve_step(Resolver &resolver, int stage) {
+    if (stage == 0) {
+        resolver.enter();
+        Scope &body_scope = *resolver.scope;
+        for (const Symbol &formal_arg : *formal_args)
+            body_scope.bind(formal_arg);
+        if (!self_name.str().empty()) {
+            body_scope.bind(self_name);
+            std::rotate(body_scope.bindings.begin(), body_scope.bindings.end() - 1, body_scope.bindings.end());
+        }
+        resolver.visit(actual_arg);
+        return false;
+    }
+    int body_frame_size = resolver.leave();
+    resolver.give(NEW(FunExpr)(self_name, formal_args, resolver.take(), body_frame_size));
+    return true;
 }
 
-void FunExpr::step_interp() {
-    Step::mode = Step::continue_mode;
-    Step::val = NEW(FunVal)(formal_arg, actual_arg, Step::env);
-    Step::cont = Step::cont;
+PTR(Expr) FunExpr::subst(const Symbol &var, PTR(Val) val) {
+    if (!has_free_var(var))
+        return THIS;
+    return NEW(FunExpr)(self_name, formal_args, actual_arg->subst(var, val));
 }
 
-PTR(Expr) FunExpr::subst(std::string var, PTR(Val) val) {
-    if (formal_arg != var) return NEW(FunExpr)(formal_arg, actual_arg->subst(var, val));
-    return NEW(FunExpr)(formal_arg, actual_arg);
+var_list_t FunExpr::find_free_vars() {
+    var_list_t vars = actual_arg->free_vars();
+    for (const Symbol &formal_arg : *formal_args)
+        vars = without(vars, formal_arg);
+    return without(vars, self_name);
 }
 
-bool FunExpr::contains_var() {
-    return actual_arg->contains_var();
+bool FunExpr::optimize_step(Optimizer &optimizer, int stage) {
+    if (stage == 0) {
+        if (optimizer.recall(this))
+            return true;
+        optimizer.bind(self_name, nullptr);
+        for (const Symbol &formal_arg : *formal_args)
+            optimizer.bind(formal_arg, nullptr);
+        optimizer.visit(actual_arg);
+        return false;
+    }
+    for (auto formal_arg = formal_args->rbegin(); formal_arg != formal_args->rend(); ++formal_arg)
+        optimizer.unbind(*formal_arg);
+    optimizer.unbind(self_name);
+    optimizer.finish(this, NEW(FunExpr)(self_name, formal_args, optimizer.take()));
+    return true;
 }
 
-PTR(Expr) FunExpr::optimize() {
-    return NEW(FunExpr)(formal_arg, actual_arg->optimize());
+bool FunExpr::print_step(Printer &printer, int stage) {
+    if (stage == 0) {
+        std::string formals;
+        for (const Symbol &formal_arg : *formal_args)
+            formals += (formals.empty() ? "" : ", ") + formal_arg.str();
+        std::string name = self_name.str().empty() ? "" : self_name.str() + " ";
+        printer.out += "(_fun " + name + "(" + formals + ") ";
+        printer.visit(actual_arg);
+        return false;
+    }
+    printer.out += ")";
+    return true;
 }
 
-std::string FunExpr::expr_print() {
-    return "(_fun (" + formal_arg + ") " + actual_arg->expr_print() + ")";
+CallExpr::CallExpr(PTR(Expr) to_be_called, PTR(Expr) actual_argument)
+        : CallExpr(to_be_called, std::vector<PTR(Expr)>(1, actual_argument)) {
 }
 
-CallExpr::CallExpr(PTR(Expr) to_be_called, PTR(Expr) actual_argument) {
+CallExpr::CallExpr(PTR(Expr) to_be_called, std::vector<PTR(Expr)> actual_args) {
     this->to_be_called = to_be_called;
-    this->actual_argument = actual_argument;
+    this->actual_args = std::move(actual_args);
+    this->has_var = to_be_called->has_var;
+    this->has_call = true;
+    this->size = 1 + to_be_called->size;
+    for (const PTR(Expr) &actual_arg : this->actual_args) {
+        this->has_var = this->has_var || actual_arg->has_var;
+        this->size += actual_arg->size;
+    }
+}
+
+CallExpr::~CallExpr() {
+    Teardown::release(to_be_called);
+    for (PTR(Expr) &actual_arg : actual_args)
+        Teardown::release(actual_arg);
 }
 
 bool CallExpr::equals(PTR(Expr) e) {
+    if (identity_decides(e))
+        return &*e == this;
     PTR(CallExpr) c = CAST(CallExpr)(e);
-    if (c == NULL)
+    if (c == NULL || !this->to_be_called->equals(c->to_be_called) || this->actual_args.size() != c->actual_args.size())
         return false;
-    else
-        return (this->to_be_called->equals(c->to_be_called) && (this->actual_argument->equals(c->actual_argument)));
+    for (size_t i = 0; i < actual_args.size(); i++)
+        if (!this->actual_args[i]->equals(c->actual_args[i]))
+            return false;
+    return true;
 }
 
 PTR(Val) CallExpr::interp(PTR(Env) env) {
-    return to_be_called->interp(env)->call(actual_argument->interp(env));
+    return interp_trampoline(env);
+}
+
+// All the arguments of a call with more than one are collected and
+// bound into a single frame.
+PTR(Val) CallExpr::interp_tail(PTR(Env) &env, PTR(Expr) &next) {
+    PTR(Val) to_be_called_val;
+    if (actual_args.size() == 1) {
+        PTR(Val) actual_arg_val;
+        ForkJoin::interp_pair(to_be_called, actual_args[0], env, to_be_called_val, actual_arg_val);
+        if (to_be_called_val->tag == Val::fun_tag) {
+            FunVal *f = static_cast<FunVal *>(&*to_be_called_val);
+            if (f->code == nullptr) {
+                if (MemoCache::memoizable(to_be_called_val, actual_arg_val)) {
+                    MemoCache &memo = MemoCache::local();
+                    if (PTR(Val) result = memo.find(to_be_called_val, actual_arg_val))
+                        return result;
+                    memo.defer(to_be_called_val, actual_arg_val);
+                }
+                env = f->bind_arg(actual_arg_val);
+                next = f->body;
+                return nullptr;
+            }
+        }
+        return to_be_called_val->call(actual_arg_val);
+    }
+
+    to_be_called_val = to_be_called->interp(env);
+    std::vector<PTR(Val)> actual_arg_vals;
+    actual_arg_vals.reserve(actual_args.size());
+    for (const PTR(Expr) &actual_arg : actual_args)
+        actual_arg_vals.push_back(actual_arg->interp(env));
+    if (to_be_called_val->tag == Val::fun_tag) {
+        FunVal *f = static_cast<FunVal *>(&*to_be_called_val);
+        if (f->code == nullptr) {
+            env = f->bind_args(std::move(actual_arg_vals));
+            next = f->body;
+            return nullptr;
+        }
+    }
+    return to_be_called_val->call_with(std::move(actual_arg_vals));
 }
 
-void CallExpr::step_interp() {
-    Step::mode = Step::interp_mode;
-    Step::expr = to_be_called;
-    Step::cont = NEW(ArgThenCallCont)(actual_argument, Step::env, Step::cont);
+void CallExpr::step_interp(Step &step) {
+    if (actual_args.size() == 1)
+        step.conts.push_back(Cont(Cont::arg_then_call, actual_args[0], step.env));
+    else
+        step.conts.push_back(Cont(Cont::args_then_call, THIS, step.env));
+    step.mode = Step::interp_mode;
+    step.expr = to_be_called;
+}
+
+void CallExpr::compile(Bytecode &code) {
+    to_be_called->compile(code);
+    for (const PTR(Expr) &actual_arg : actual_args)
+        actual_arg->compile(code);
+    code.emit(Bytecode::op_call, (int) actual_args.size());
+}
+
+compiled_t CallExpr::compile_closure() {
+    compiled_t callee_code = to_be_called->compile_closure();
+    if (actual_args.size() == 1) {
+        compiled_t arg_code = actual_args[0]->compile_closure();
+        return [callee_code = std::move(callee_code), arg_code = std::move(arg_code)](const PTR(FrameEnv) &frame) {
+            PTR(Val) to_be_called_val = callee_code(frame);
+            return to_be_called_val->call(arg_code(frame));
+        };
+    }
+
+    std::vector<compiled_t> arg_codes;
+    for (const PTR(Expr) &actual_arg : actual_args)
+        arg_codes.push_back(actual_arg->compile_closure());
+    return [callee_code = std::move(callee_code), arg_codes = std::move(arg_codes)](const PTR(FrameEnv) &frame) {
+        PTR(Val) to_be_called_val = callee_code(frame);
+        std::vector<PTR(Val)> actual_arg_vals;
+        actual_arg_vals.reserve(arg_codes.size());
+        for (const compiled_t &arg_code : arg_codes)
+            actual_arg_vals.push_back(arg_code(frame));
+        return to_be_called_val->call_with(std::move(actual_arg_vals));
+    };
+}
+
+// A compiled function called in tail position is handed back to
+// FunVal::run_code with its frame, instead of being run here.
+compiled_tail_t CallExpr::compile_tail_closure() {
+    compiled_t callee_code = to_be_called->compile_closure();
+    if (actual_args.size() == 1) {
+        compiled_t arg_code = actual_args[0]->compile_closure();
+        return [callee_code = std::move(callee_code), arg_code = std::move(arg_code)](
+                const PTR(FrameEnv) &frame, PTR(Val) &next, PTR(FrameEnv) &next_frame) -> PTR(Val) {
+            PTR(Val) to_be_called_val = callee_code(frame);
+            PTR(Val) actual_arg_val = arg_code(frame);
+            if (to_be_called_val->tag == Val::fun_tag) {
+                FunVal *f = static_cast<FunVal *>(&*to_be_called_val);
+                if (f->code != nullptr) {
+                    next_frame = f->bind_frame(actual_arg_val);
+                    next = std::move(to_be_called_val);
+                    return nullptr;
+                }
+            }
+            return to_be_called_val->call(actual_arg_val);
+        };
+    }
+
+    std::vector<compiled_t> arg_codes;
+    for (const PTR(Expr) &actual_arg : actual_args)
+        arg_codes.push_back(actual_arg->compile_closure());
+    return [callee_code = std::move(callee_code), arg_codes = std::move(arg_codes)](
+            const PTR(FrameEnv) &frame, PTR(Val) &next, PTR(FrameEnv) &next_frame) -> PTR(Val) {
+        PTR(Val) to_be_called_val = callee_code(frame);
+        std::vector<PTR(Val)> actual_arg_vals;
+        actual_arg_vals.reserve(arg_codes.size());
+        for (const compiled_t &arg_code : arg_codes)
+            actual_arg_vals.push_back(arg_code(frame));
+        if (to_be_called_val->tag == Val::fun_tag) {
+            FunVal *f = static_cast<FunVal *>(&*to_be_called_val);
+            if (f->code != nullptr) {
+                next_frame = f->bind_args(std::move(actual_arg_vals));
+                next = std::move(to_be_called_val);
+                return nullptr;
+            }
+        }
+        return to_be_called_val->call_with(std::move(actual_arg_vals));
+    };
 }
 
-PTR(Expr) CallExpr::subst(std::string var, PTR(Val) val) {
-    return NEW(CallExpr)(to_be_called->subst(var, val), actual_argument->subst(var, val));
+bool CallExpr::resolve_step(Resolver &resolver, int stage) {
+    if (stage == 0) {
+        resolver.visit(to_be_called);
+        return false;
+    }
+    if (stage <= (int) actual_args.size()) {
+        resolver.visit(actual_args[stage - 1]);
+        return false;
+    }
+    std::vector<PTR(Expr)> resolved_args(actual_args.size());
+    for (size_t i = actual_args.size(); i > 0; i--)
+        resolved_args[i - 1] = resolver.take();
+    PTR(Expr) resolved_callee = resolver.take();
+    resolver.give(NEW(CallExpr)(resolved_callee, std::move(resolved_args)));
+    return true;
 }
 
-bool CallExpr::contains_var() {
-    return to_be_called->contains_var() || actual_argument->contains_var();
+PTR(Expr) CallExpr::subst(const Symbol &var, PTR(Val) val) {
+    if (!has_free_var(var))
+        return THIS;
+    PTR(Expr) substituted_callee = to_be_called->subst(var, val);
+    std::vector<PTR(Expr)> substituted_args;
+    for (const PTR(Expr) &actual_arg : actual_args)
+        substituted_args.push_back(actual_arg->subst(var, val));
+    return NEW(CallExpr)(substituted_callee, std::move(substituted_args));
 }
 
-PTR(Expr) CallExpr::optimize() {
-    return NEW(CallExpr)(to_be_called->optimize(), actual_argument->optimize());
+var_list_t CallExpr::find_free_vars() {
+    var_list_t vars = to_be_called->free_vars();
+    for (const PTR(Expr) &actual_arg : actual_args)
+        vars = union_of(vars, actual_arg->free_vars());
+    return vars;
 }
 
-std::string CallExpr::expr_print() {
-    return "(" + to_be_called->expr_print() + "(" + actual_argument->expr_print() + "))";
+
+bool CallExpr::optimize_step(Optimizer &optimizer, int stage) {
+    if (stage == 0) {
+        if (optimizer.recall(this))
+            return true;
+        optimizer.visit(to_be_called);
+        return false;
+    }
+    if (stage <= (int) actual_args.size()) {
+        optimizer.visit(actual_args[stage - 1]);
+        return false;
+    }
+    std::vector<PTR(Expr)> optimized_args(actual_args.size());
+    for (size_t i = actual_args.size(); i > 0; i--)
+        optimized_args[i - 1] = optimizer.take();
+    PTR(Expr) optimized_callee = optimizer.take();
+    optimizer.finish(this, NEW(CallExpr)(optimized_callee, std::move(optimized_args)));
+    return true;
+}
+
+bool CallExpr::print_step(Printer &printer, int stage) {
+    if (stage == 0) {
+        printer.out += "(";
+        printer.visit(to_be_called);
+        return false;
+    }
+    if (stage <= (int) actual_args.size()) {
+        printer.out += (stage == 1) ? "(" : ", ";
+        printer.visit(actual_args[stage - 1]);
+        return false;
+    }
+    printer.out += (actual_args.empty()) ? "())" : "))";
+    return true;
 }
 
 TEST_CASE("equals") {
@@ -633,6 +1568,13 @@ TEST_CASE("optimize") {
     CHECK(parse_str(" x == x")->optimize()->equals(NEW(EqualExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))));
     CHECK(parse_str(" (x) == x")->optimize()->equals(NEW(EqualExpr)(NEW(VarExpr)("x"), NEW(VarExpr)("x"))));
     CHECK(parse_str("_true")->optimize()->equals(NEW(BoolExpr)(true)));
+    CHECK(parse_str("_let x = 1 _in _if x == 1 _then x _else y")->optimize()->equals(NEW(NumExpr)(1)));
+    CHECK(parse_str("_let x = 1 _in (_let x = y _in x) + x")->optimize()->equals(
+            NEW(AddExpr)(NEW(LetExpr)("x", NEW(VarExpr)("y"), NEW(VarExpr)("x")), NEW(NumExpr)(1))));
+    CHECK(parse_str("_let x = 1 _in _fun (x) x + y * x")->optimize()->equals(
+            NEW(FunExpr)("x", NEW(AddExpr)(NEW(VarExpr)("x"), NEW(MultExpr)(NEW(VarExpr)("y"), NEW(VarExpr)("x"))))));
+    CHECK(parse_str("_let x = 1 _in _let f = _fun (y) x + y _in f")->optimize()->expr_print()
+          == "_let f = (_fun (y) (1 + y)) _in f");
     CHECK(parse_str("_fun (x) x + 3")->optimize()->equals(NEW(FunExpr)("x", NEW(AddExpr)(NEW(VarExpr)("x"), NEW(NumExpr)(3)))));
     CHECK(parse_str("_fun (x) 3 + 3")->optimize()->equals(NEW(FunExpr)("x", NEW(NumExpr)(6))));
     CHECK(parse_str("(_fun (x) x + 10)(45)")->optimize()->equals(NEW(CallExpr)(NEW(FunExpr)("x",
@@ -654,6 +1596,140 @@ TEST_CASE("optimize") {
                                      " _in fib(fib)(10)")));
 }
 
+TEST_CASE("optimize reuses work") {
+    // Each level refers to the one below twice, so the tree has 2^61 - 1 nodes but only 61 distinct ones.
+    PTR(Expr) e = NEW(VarExpr)("x");
+    for (int i = 0; i < 60; i++)
+        e = NEW(AddExpr)(e, e);
+    CHECK(e->size == ((size_t) 1 << 61) - 1);
+    CHECK(e->has_free_var("x"));
+    CHECK(e->optimize()->contains_var());
+    CHECK(&*e->optimize() == &*e->optimize());
+
+    PTR(Expr) f = parse_str("_fun (x) x + y");
+    CHECK(!f->has_free_var("x"));
+    CHECK(f->has_free_var("y"));
+    CHECK(&*f->subst("x", NEW(NumVal)(1)) == &*f);
+
+    // _let x0 = 1 _in _let x1 = x0 + 1 _in ... x9999
+    PTR(Expr) chain = NEW(VarExpr)("x9999");
+    for (int i = 9999; i > 0; i--)
+        chain = NEW(LetExpr)("x" + std::to_string(i),
+                             NEW(AddExpr)(NEW(VarExpr)("x" + std::to_string(i - 1)), NEW(NumExpr)(1)), chain);
+    chain = NEW(LetExpr)("x0", NEW(NumExpr)(1), chain);
+    CHECK(chain->free_vars() == nullptr);
+    CHECK(chain->optimize()->equals(NEW(NumExpr)(10000)));
+
+    // Deep chains are optimized and printed without recursing per node.
+    const int n = 100000;
+    std::string sum = "y";
+    for (int i = 1; i < n; i++)
+        sum += " + y";
+    PTR(Expr) deep = parse_str(sum);
+    CHECK(deep->size == 2 * n - 1);
+    std::string printed = deep->optimize()->expr_print();
+    CHECK(printed.size() == 6 * (size_t) n - 5);
+    CHECK(printed.substr(0, 12) == "(y + (y + (y");
+    CHECK(printed.substr(printed.size() - n - 5) == "(y + y)" + std::string(n - 2, ')'));
+    std::string folded = run_program(parse_str(sum + " + 1 + 2"), optimize_mode);
+    CHECK(folded.substr(folded.size() - n - 5) == "y + 3" + std::string(n, ')'));
+    std::string ones = "1";
+    for (int i = 1; i < n; i++)
+        ones += " + 1";
+    CHECK(parse_str(ones)->optimize()->equals(NEW(NumExpr)(n)));
+
+    // _let v0 = 0 _in _let v1 = 1 _in ... _in v0 + v1 + ... + v4999, whose lets are each optimized once.
+    const int lets = 5000;
+    PTR(Expr) total = NEW(VarExpr)("v0");
+    for (int i = 1; i < lets; i++)
+        total = NEW(AddExpr)(total, NEW(VarExpr)("v" + std::to_string(i)));
+    for (int i = lets - 1; i >= 0; i--)
+        total = NEW(LetExpr)("v" + std::to_string(i), NEW(NumExpr)(i), total);
+    CHECK(total->optimize()->equals(NEW(NumExpr)(lets * (lets - 1) / 2)));
+}
+
+TEST_CASE("tail calls") {
+    // Each loop makes a million calls in tail position, which would overflow the C++ stack if each call nested.
+    PTR(Expr) if_loop = parse_str("_let loop = _fun (loop) _fun (n) _if n == 0 _then 0 _else loop(loop)(n + -1)"
+                                  "_in loop(loop)(1000000)");
+    PTR(Expr) let_loop = parse_str("_let loop = _fun (loop) _fun (n) _let m = n + -1 _in _if m == 0 _then 7 _else loop(loop)(m)"
+                                   "_in loop(loop)(1000000)");
+    CHECK(if_loop->interp(Env::empty)->equals(NEW(NumVal)(0)));
+    CHECK(interp_resolved(if_loop)->equals(NEW(NumVal)(0)));
+    CHECK(let_loop->interp(Env::empty)->equals(NEW(NumVal)(7)));
+    CHECK(interp_resolved(let_loop)->equals(NEW(NumVal)(7)));
+}
+
+TEST_CASE("multiple arguments") {
+    PTR(Expr) digits = parse_str("_let f = _fun (a, b, c) a * 100 + b * 10 + c _in f(1, 2, 3) + f(3, 2, 1)");
+    PTR(FunExpr) f = CAST(FunExpr)(CAST(LetExpr)(digits)->var_val);
+    CHECK(*f->formal_args == std::vector<Symbol>({"a", "b", "c"}));
+    CHECK(CAST(CallExpr)(CAST(AddExpr)(CAST(LetExpr)(digits)->in_expr)->lhs)->actual_args.size() == 3);
+    CHECK(f->free_vars() == nullptr);
+    CHECK(digits->subst("a", NEW(NumVal)(9)) == digits);
+    CHECK(parse_str("_fun (a, b) a + c")->subst("c", NEW(NumVal)(9))->equals(parse_str("_fun (a, b) a + 9")));
+    CHECK(!parse_str("_fun (a, b) a")->equals(parse_str("_fun (b, a) a")));
+    CHECK(!parse_str("f(1, 2)")->equals(parse_str("f(1)(2)")));
+
+    // Every mode binds all the arguments of a call in one frame.
+    const run_mode_t modes[] = {interp_mode, step_mode, vm_mode, compiled_mode};
+    for (run_mode_t mode : modes) {
+        std::string digits_result = run_program(digits, mode);
+        CHECK(digits_result == "444");
+        CHECK(run_program(parse_str("(_fun (x, x) x)(1, 2)"), mode) == "2");
+        CHECK(run_program(parse_str("_let y = 5 _in _let f = _fun (x, z) _fun (w) x + y + z + w _in f(1, 2)(3)"),
+                          mode) == "11");
+        CHECK(run_program(parse_str("_let f = _fun (x) x _in (_fun (g, n) g(n + 1))(f, 4)"), mode) == "5");
+        CHECK_THROWS_WITH(run_program(parse_str("(_fun (a, b) a)(1)"), mode), "wrong number of arguments");
+        CHECK_THROWS_WITH(run_program(parse_str("(_fun (a) a)(1, 2)"), mode), "wrong number of arguments");
+        CHECK_THROWS_WITH(run_program(parse_str("(_fun (a, b) a)(1, y)"), mode), "free variable: y");
+    }
+    CHECK(parse_str("(7)(1, 2)")->interp(Env::empty)->equals(NEW(NumVal)(7)));
+    CHECK_THROWS_WITH(Step::interp_by_steps(parse_str("(7)(1, 2)")), "Cannot call call_step on a NumVal.");
+    CHECK(run_program(parse_str("_fun (a, b) a + 1 * 2"), optimize_mode) == "(_fun (a, b) (a + 2))");
+
+    PTR(Expr) loop = parse_str("_let loop = _fun (loop, n) _if n == 0 _then 0 _else loop(loop, n + -1)"
+                               "_in loop(loop, 1000000)");
+    CHECK(loop->interp(Env::empty)->equals(NEW(NumVal)(0)));
+    CHECK(interp_resolved(loop)->equals(NEW(NumVal)(0)));
+}
+
+TEST_CASE("letrec") {
+    PTR(Expr) fib = parse_str("_letrec fib = _fun (x) _if x == 0 _then 1 _else _if x == 1 _then 1"
+                              "  _else fib(x + -1) + fib(x + -2)"
+                              "_in fib(10)");
+    PTR(FunExpr) f = CAST(FunExpr)(CAST(LetExpr)(fib)->var_val);
+    CHECK(f->self_name == "fib");
+    CHECK(f->free_vars() == nullptr);
+    CHECK(fib->equals(parse_str("_let fib = _fun fib (x) _if x == 0 _then 1 _else _if x == 1 _then 1"
+                                "  _else fib(x + -1) + fib(x + -2)"
+                                "_in fib(10)")));
+    CHECK(!f->equals(parse_str("_fun (x) _if x == 0 _then 1 _else _if x == 1 _then 1"
+                               "  _else fib(x + -1) + fib(x + -2)")));
+    CHECK(fib->optimize()->equals(fib));
+    CHECK(fib->optimize()->expr_print().rfind("_let fib = (_fun fib (x) _if", 0) == 0);
+
+    // Every mode binds the function's own name in each call's frame.
+    const run_mode_t modes[] = {interp_mode, step_mode, vm_mode, compiled_mode};
+    for (run_mode_t mode : modes) {
+        std::string fib_result = run_program(fib, mode);
+        CHECK(fib_result == "89");
+        CHECK(run_program(parse_str("_letrec f = _fun (f) f _in f(3)"), mode) == "3");
+        CHECK(run_program(parse_str("_letrec f = _fun (n) _if n == 0 _then 0 _else n + f(n + -1) _in f(100)"), mode)
+              == "5050");
+        CHECK(run_program(parse_str("_letrec pow = _fun (b, e) _if e == 0 _then 1 _else b * pow(b, e + -1)"
+                                    "_in _let f = pow _in f(2, 10)"), mode) == "1024");
+        CHECK(run_program(parse_str("_letrec f = _fun (n) _let g = _fun (m) f(m) _in _if n == 0 _then 7 _else g(n + -1)"
+                                    "_in f(5)"), mode) == "7");
+    }
+    CHECK(parse_str("_let f = 1 _in (_fun f (n) f)(2)")->interp(Env::empty)->to_string() == "[function]");
+    CHECK(parse_str("_let f = 1 _in (_fun g (n) f)(2)")->interp(Env::empty)->equals(NEW(NumVal)(1)));
+
+    PTR(Expr) loop = parse_str("_letrec loop = _fun (n) _if n == 0 _then 0 _else loop(n + -1) _in loop(1000000)");
+    CHECK(loop->interp(Env::empty)->equals(NEW(NumVal)(0)));
+    CHECK(interp_resolved(loop)->equals(NEW(NumVal)(0)));
+}
+
 TEST_CASE("expr_print") {
     PTR(NumExpr) numfive = NEW(NumExpr)(5);
     PTR(NumExpr) numten = NEW(NumExpr)(10);
@@ -4,87 +4,291 @@
 
 #pragma once
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "value.hpp"
 #include "pointer.hpp"
+#include "symbol.hpp"
 #include "env.hpp"
 
+class Bytecode;
+class Scope;
+class Resolver;
+class Optimizer;
+class Printer;
+
 
 class Expr ENABLE_THIS(Expr){
 public:
-    virtual bool equals(PTR(Expr) e) = 0;
-    virtual PTR(Val) interp(PTR(Env) env) = 0;
-    virtual void step_interp() = 0;
-    virtual PTR(Expr) subst(std::string, PTR(Val)) = 0;
-    virtual bool contains_var() = 0;
-    virtual PTR(Expr) optimize() = 0;
-    virtual std::string expr_print() = 0;
-};
+    /* Id of the ExprFactory that made this node, or 0 if it was made directly. */
+    unsigned long consed_by = 0;
 
-/**
- * The <code>NumExpr</code> class represents an integer as an Expr.
- */
-class NumExpr: public Expr {
-public:
-    int rep;
-    PTR(Val) val;
+    /**
+     * Returns true if comparing addresses is enough to decide <code>equals(e)</code>. That is the case when
+     * both nodes are the same node, or were made by the same ExprFactory.
+     * @param e Expr to compare.
+     * @return true if <code>equals(e)</code> is exactly whether e is this node.
+     */
+    bool identity_decides(const PTR(Expr) &e) {
+        return (&*e == this) || (consed_by != 0 && consed_by == e->consed_by);
+    }
+
+    /* Facts about the subtree rooted here, computed once by the constructor from the children's. */
+    bool has_var = false;
+    /* True if evaluating the subtree may call a function, so its cost is not bounded by its size. */
+    bool has_call = false;
+    size_t size = 1;
+
+    /* What optimize() and subst() have worked out about this node, made the first time either needs it,
+     * so nodes that are only interpreted stay small. */
+    typedef struct {
+        var_list_t free_vars;
+        bool free_vars_known = false;
+        PTR(Expr) optimized;
+    } cache_t;
+    std::unique_ptr<cache_t> cache;
+
+    cache_t &cached() {
+        if (cache == nullptr)
+            cache.reset(new cache_t());
+        return *cache;
+    }
+
+    virtual ~Expr();
 
     /**
-     * Construct a NumExpr from an int.
-     * @param rep int to be represented by this NumExpr.
+     * Determines if this Expr contains a variable and returns a boolean.
+     * @return true if Expr contains variable, false otherwise.
      */
-    NumExpr(int rep);
+    bool contains_var() {
+        return has_var;
+    }
 
     /**
-     * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
-     * @param e Expr to compare.
-     * @return true if expressions are equal, false otherwise.
+     * Determines if a variable occurs free in this Expr, which is exactly when <code>subst</code> would change it.
+     * @param var variable to look for.
+     * @return true if var is free in this Expr, false otherwise.
      */
-    bool equals(PTR(Expr) e);
+    bool has_free_var(const Symbol &var) {
+        const var_list_t &vars = free_vars();
+        return vars && std::binary_search(vars->begin(), vars->end(), var);
+    }
 
     /**
-     * Evaluates the Expr and returns a Val. Takes an Env as parameter e.
-     * /exception If the evaluation reaches a free variable, an error will be thrown.
-     * @param env
+     * Returns the variables that occur free in this Expr, sorted. The list is shared with a child whenever they are
+     * the same.
+     * @return free variables, or null if there are none.
+     */
+    const var_list_t &free_vars() {
+        static const var_list_t none;
+        if (!has_var)
+            return none;
+        cache_t &c = cached();
+        if (!c.free_vars_known) {
+            c.free_vars = find_free_vars();
+            c.free_vars_known = true;
+        }
+        return c.free_vars;
+    }
+
+    /**
+     * Evaluates the Expr like <code>interp</code>, except that an Expr in tail position is not evaluated here.
+     * Instead it is stored in next, with the Env to evaluate it in stored in env, and nullptr is returned.
+     * Exprs with no tail position just return <code>interp(env)</code>.
+     * @param env Env to evaluate in, replaced by the Env for next.
+     * @param next set to the Expr that produces the result, if this Expr did not produce it.
+     * @return Val of the Expr, or nullptr if evaluation continues with next.
+     */
+    virtual PTR(Val) interp_tail(PTR(Env) &env, PTR(Expr) &next) {
+        return interp(env);
+    }
+
+    /**
+     * Evaluates the Expr with <code>interp_tail</code>, and then each Expr it continues with in turn, so calls
+     * in tail position do not grow the C++ stack.
+     * @param env Env to evaluate in.
      * @return Val representing the Expr solution or a semantically equivalent value.
      */
-    PTR(Val) interp(PTR(Env) env);
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+    PTR(Val) interp_trampoline(PTR(Env) env);
 
     /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
+     * Rewrites the Expr's variables to the frame slots they are bound to in scope. The Expr is walked with an
+     * explicit stack, so however deeply it is nested the C++ stack does not grow.
+     * @param scope Scope the Expr is in. Its frame grows by the slots the Expr binds, and its bindings are left as they were.
+     * @return resolved Expr.
      */
-    bool contains_var();
+    PTR(Expr) resolve(Scope &scope);
 
     /**
      * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
      * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
+     * a free variable. The Expr is walked with an explicit stack, and each node remembers its result.
      * @return Expr representing the most optimized solution or a semantically equivalent Expr.
      */
     PTR(Expr) optimize();
 
     /**
-     * Returns the Expr in a human readable string.
+     * Returns the Expr in a human readable string. The Expr is walked with an explicit stack.
      * @return String of the Expr.
      */
     std::string expr_print();
+
+    virtual bool equals(PTR(Expr) e) = 0;
+    virtual PTR(Val) interp(PTR(Env) env) = 0;
+    virtual void step_interp(Step &step) = 0;
+    virtual void compile(Bytecode &code) = 0;
+    virtual compiled_t compile_closure() = 0;
+
+    /**
+     * Compiles the Expr like <code>compile_closure</code>, for a tail position of a function's body. Like
+     * <code>interp_tail</code>, a call to a compiled function in tail position is left to the caller to make.
+     * Exprs with no tail position just run their <code>compile_closure</code> code.
+     * @return code of the Expr.
+     */
+    virtual compiled_tail_t compile_tail_closure();
+    virtual bool resolve_step(Resolver &resolver, int stage) = 0;
+    virtual PTR(Expr) subst(const Symbol &, PTR(Val)) = 0;
+    virtual var_list_t find_free_vars() = 0;
+    virtual bool optimize_step(Optimizer &optimizer, int stage) = 0;
+    virtual bool print_step(Printer &printer, int stage) = 0;
 };
 
 /**
- * The <code>VarExpr</code> class represents a variable as an Expr.
+ * An <code>Optimizer</code> walks an Expr for <code>Expr::optimize</code>, keeping the nodes it is part way through
+ * on its own stack. Each node's <code>optimize_step</code> is called once per stage, starting from 0, until it
+ * returns true. At each stage a node either visits an Expr, whose optimized Expr is then left on
+ * <code>results</code>, or takes what it visited off <code>results</code> and gives its own optimized Expr.
+ * The value of each closed <code>_let</code> is bound to its name while its body is visited, so variables are
+ * replaced as they are reached instead of by a <code>subst</code> of the body.
  */
-class VarExpr: public Expr {
+class Optimizer {
 public:
-    std::string name;
+    std::vector<PTR(Expr)> results;
 
     /**
-     * Construct a VarExpr from an string.
-     * @param val string variable.
+     * Optimizes an Expr by calling the <code>optimize_step</code> of each node until all are done.
+     * @param e Expr to optimize.
+     * @return optimized Expr.
+     */
+    PTR(Expr) run(PTR(Expr) e);
+
+    /**
+     * Optimizes an Expr before the node that visits it takes its next stage.
+     * @param e Expr to optimize.
+     */
+    void visit(PTR(Expr) e);
+
+    /**
+     * @return the most recent optimized Expr, removed from <code>results</code>.
+     */
+    PTR(Expr) take();
+
+    /**
+     * Finishes a node.
+     * @param e optimized node.
+     */
+    void give(PTR(Expr) e);
+
+    /**
+     * Finishes a node, remembering its optimized Expr for the next time it is visited with the same bindings.
+     * @param e node.
+     * @param optimized optimized node.
+     */
+    void finish(Expr *e, PTR(Expr) optimized);
+
+    /**
+     * Finishes a node that was already optimized with the same bindings, giving what it was optimized to.
+     * @param e node.
+     * @return true if the node was finished.
+     */
+    bool recall(Expr *e);
+
+    /**
+     * Binds a name until the matching <code>unbind</code>.
+     * @param name name to bind.
+     * @param e closed Expr to replace the variable with, or nullptr to leave it a variable.
+     */
+    void bind(const Symbol &name, PTR(Expr) e);
+
+    /**
+     * Removes the most recent binding of a name.
+     * @param name name to unbind.
      */
-    VarExpr(std::string val);
+    void unbind(const Symbol &name);
+
+    /**
+     * @param name name of a variable.
+     * @return closed Expr bound to the name, or nullptr if it is not replaced.
+     */
+    PTR(Expr) lookup(const Symbol &name);
+
+private:
+    typedef struct {
+        PTR(Expr) expr;
+        int stage;
+    } frame_t;
+
+    std::vector<frame_t> frames;
+    std::unordered_map<Symbol, std::vector<PTR(Expr)>> bindings;
+    /* Number of bindings to closed Exprs. While there are none, optimized nodes are remembered on the nodes. */
+    int closed = 0;
+    /* Optimized nodes for each binding made while there are closed ones, since they depend on the bindings. */
+    std::vector<std::unordered_map<Expr *, PTR(Expr)>> scopes;
+};
+
+/**
+ * A <code>Printer</code> walks an Expr for <code>Expr::expr_print</code>, keeping the nodes it is part way through
+ * on its own stack. Each node's <code>print_step</code> is called once per stage, starting from 0, until it returns
+ * true. At each stage a node appends text to <code>out</code>, and may visit a child to print after it.
+ */
+class Printer {
+public:
+    std::string out;
+
+    /**
+     * Prints an Expr by calling the <code>print_step</code> of each node until all are done.
+     * @param e Expr to print.
+     */
+    void run(PTR(Expr) e);
+
+    /**
+     * Prints a child before the node that visits it takes its next stage.
+     * @param e child to print.
+     */
+    void visit(PTR(Expr) e);
+
+private:
+    typedef struct {
+        PTR(Expr) expr;
+        int stage;
+    } frame_t;
+
+    std::vector<frame_t> frames;
+};
+
+/**
+ * The <code>NumExpr</code> class represents an integer as an Expr.
+ */
+class NumExpr: public Expr {
+public:
+    int64_t rep;
+    PTR(Val) val;
+
+    /**
+     * Construct a NumExpr from an int.
+     * @param rep int to be represented by this NumExpr.
+     */
+    NumExpr(int64_t rep);
+
+    /**
+     * Construct a NumExpr from an integer of any size. Its value is a BigNumVal if it does not fit in rep, and rep
+     * is then 0.
+     * @param rep integer to be represented by this NumExpr.
+     */
+    NumExpr(const BigInt &rep);
 
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
@@ -100,29 +304,63 @@ public:
      * @return Val representing the Expr solution or a semantically equivalent value.
      */
     PTR(Val) interp(PTR(Env) env);
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
+};
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
+/**
+ * The <code>VarExpr</code> class represents a variable as an Expr.
+ */
+class VarExpr: public Expr {
+public:
+    Symbol name;
+    int depth;
+    int slot;
 
     /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
+     * Construct a VarExpr from an string.
+     * @param val string variable.
      */
-    bool contains_var();
+    VarExpr(const Symbol &val);
 
     /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
+     * Construct a VarExpr that has been resolved to a frame slot.
+     * @param val string variable.
+     * @param depth number of frames out the variable is bound.
+     * @param slot slot the variable is stored in.
      */
-    PTR(Expr) optimize();
+    VarExpr(const Symbol &val, int depth, int slot);
+    ~VarExpr();
 
     /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
+     * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
+     * @param e Expr to compare.
+     * @return true if expressions are equal, false otherwise.
      */
-    std::string expr_print();
+    bool equals(PTR(Expr) e);
+
+    /**
+     * Evaluates the Expr and returns a Val. Takes an Env as parameter e.
+     * /exception If the evaluation reaches a free variable, an error will be thrown.
+     * @param env
+     * @return Val representing the Expr solution or a semantically equivalent value.
+     */
+    PTR(Val) interp(PTR(Env) env);
+
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
@@ -139,6 +377,7 @@ public:
      * @param rhs right hand side Expr.
      */
     AddExpr(PTR(Expr) lhs, PTR(Expr) rhs);
+    ~AddExpr();
 
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
@@ -155,27 +394,14 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
@@ -192,6 +418,7 @@ public:
      * @param rhs right hand side Expr.
      */
     MultExpr(PTR(Expr) lhs, PTR(Expr) rhs);
+    ~MultExpr();
 
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
@@ -208,28 +435,14 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
@@ -238,9 +451,10 @@ public:
  */
 class LetExpr: public Expr {
 public:
-    std::string name;
+    Symbol name;
     PTR(Expr) var_val;
     PTR(Expr) in_expr;
+    int slot;
 
     /**
      * Construct an LetExpr using a string to represent the variable, an Expr representing the value of that variable,
@@ -249,7 +463,17 @@ public:
      * @param var_val Expr representing the value of variable.
      * @param in_expr Expr representing the body of the LetExpr.
      */
-    LetExpr(std::string name, PTR(Expr) var_val, PTR(Expr) in_expr);
+    LetExpr(const Symbol &name, PTR(Expr) var_val, PTR(Expr) in_expr);
+
+    /**
+     * Construct a LetExpr that binds its variable into a frame slot.
+     * @param name string representing the variable.
+     * @param var_val Expr representing the value of variable.
+     * @param in_expr Expr representing the body of the LetExpr.
+     * @param slot slot the variable is stored in.
+     */
+    LetExpr(const Symbol &name, PTR(Expr) var_val, PTR(Expr) in_expr, int slot);
+    ~LetExpr();
 
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
@@ -266,28 +490,16 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    PTR(Val) interp_tail(PTR(Env) &env, PTR(Expr) &next);
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    compiled_tail_t compile_tail_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
@@ -318,28 +530,14 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
@@ -358,6 +556,7 @@ public:
      * @param else_part Expr that can be evaluated if else_part is true.
      */
     IfExpr(PTR(Expr) test_part, PTR(Expr) then_part, PTR(Expr) else_part);
+    ~IfExpr();
 
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
@@ -374,28 +573,16 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    PTR(Val) interp_tail(PTR(Env) &env, PTR(Expr) &next);
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    compiled_tail_t compile_tail_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
@@ -412,6 +599,7 @@ public:
      * @param rhs right hand side Expr.
      */
     EqualExpr(PTR(Expr) lhs, PTR(Expr) rhs);
+    ~EqualExpr();
 
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
@@ -428,45 +616,59 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
  * The <code>FunExpr</code> class is used to represent user defined functions.
  * This class can be used in conjunction with the <code>CallExpr</code> class to implement function calls.
+ * A recursive function has a self_name, which its body can use to call it.
  */
 class FunExpr : public Expr {
 public:
-    std::string formal_arg;
+    Symbol self_name;
+    var_list_t formal_args;
     PTR(Expr) actual_arg;
+    int frame_size;
 
     /**
      * Construct a FunExpr with the formal_arg represented by a string and the actual_arg represented by an Expr.
      * @param formal_arg string
      * @param actual_arg Expr representing the body of the FunExpr.
      */
-    FunExpr(std::string formal_arg, PTR(Expr) actual_arg);
+    FunExpr(const Symbol &formal_arg, PTR(Expr) actual_arg);
+
+    /**
+     * Construct a FunExpr that takes several arguments, all bound by one call.
+     * @param formal_args names of the arguments, in order.
+     * @param actual_arg Expr representing the body of the FunExpr.
+     */
+    FunExpr(var_list_t formal_args, PTR(Expr) actual_arg);
+
+    /**
+     * Construct a recursive FunExpr, whose body sees the function itself as self_name.
+     * @param self_name name the function is bound to in its own body.
+     * @param formal_args names of the arguments, in order.
+     * @param actual_arg Expr representing the body of the FunExpr.
+     */
+    FunExpr(const Symbol &self_name, var_list_t formal_args, PTR(Expr) actual_arg);
+
+    /**
+     * Construct a FunExpr whose calls bind their variables into a frame.
+     * @param self_name name the function is bound to in its own body, or the empty Symbol.
+     * @param formal_args names of the arguments, in order.
+     * @param actual_arg Expr representing the body of the FunExpr.
+     * @param frame_size number of slots in the frame of each call.
+     */
+    FunExpr(const Symbol &self_name, var_list_t formal_args, PTR(Expr) actual_arg, int frame_size);
+    ~FunExpr();
 
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
@@ -483,28 +685,14 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
 
 /**
@@ -514,7 +702,7 @@ public:
 class CallExpr : public Expr {
 public:
     PTR(Expr) to_be_called;
-    PTR(Expr) actual_argument;
+    std::vector<PTR(Expr)> actual_args;
 
     /**
      * Construct a CallExpr with two Expr's.
@@ -523,6 +711,14 @@ public:
      */
     CallExpr(PTR(Expr) to_be_called, PTR(Expr) actual_argument);
 
+    /**
+     * Construct a CallExpr that passes several arguments at once.
+     * @param to_be_called Expr
+     * @param actual_args Exprs for the arguments, in order.
+     */
+    CallExpr(PTR(Expr) to_be_called, std::vector<PTR(Expr)> actual_args);
+    ~CallExpr();
+
     /**
      * Return boolean specifying if this Expr is equal to the Expr passed in as parameter e.
      * @param e Expr to compare.
@@ -538,26 +734,14 @@ public:
      */
     PTR(Val) interp(PTR(Env) env);
 
-    void step_interp();
-    PTR(Expr) subst(std::string var, PTR(Val) val);
-
-    /**
-     * Determines if this Expr contains a variable and returns a boolean.
-     * @return true if Expr contains variable, false otherwise.
-     */
-    bool contains_var();
-
-    /**
-     * Evaluates the Expr and returns a semantically equivalent Expr that is no larger than the input Expr.
-     * Unlike the <code>interp</code> method, <code>optimize</code> will not throw an error if the evaluations reaches
-     * a free variable.
-     * @return Expr representing the most optimized solution or a semantically equivalent Expr.
-     */
-    PTR(Expr) optimize();
-
-    /**
-     * Returns the Expr in a human readable string.
-     * @return String of the Expr.
-     */
-    std::string expr_print();
+    PTR(Val) interp_tail(PTR(Env) &env, PTR(Expr) &next);
+    void step_interp(Step &step);
+    void compile(Bytecode &code);
+    compiled_t compile_closure();
+    compiled_tail_t compile_tail_closure();
+    bool resolve_step(Resolver &resolver, int stage);
+    PTR(Expr) subst(const Symbol &var, PTR(Val) val);
+    var_list_t find_free_vars();
+    bool optimize_step(Optimizer &optimizer, int stage);
+    bool print_step(Printer &printer, int stage);
 };
\ No newline at end of file
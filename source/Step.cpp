@@ -4,27 +4,148 @@
 
 #include "Step.hpp"
 #include "Cont.hpp"
+#include "scope.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
-Step::mode_t Step::mode;
+long Step::max_steps = 0;
+std::chrono::milliseconds Step::time_limit(0);
 
-PTR(Cont) Step::cont;
+Step::Step(PTR(Expr) e) {
+    Scope scope(nullptr);
+    this->mode = interp_mode;
+    this->expr = e->resolve(scope);
+    this->env = NEW(FrameEnv)(Env::empty, scope.frame_size);
+    this->val = nullptr;
+}
+
+PTR(Val) Step::run() {
+    while (1) {
+        if (mode == interp_mode) expr->step_interp(*this);
+        else {
+            if (conts.empty()) return val;
+            else conts.back().step_continue(*this);
+        }
+    }
+}
+
+bool Step::run(long steps) {
+    for (; steps > 0; steps--) {
+        if (mode == interp_mode) expr->step_interp(*this);
+        else {
+            if (conts.empty()) return true;
+            else conts.back().step_continue(*this);
+        }
+    }
+    return done();
+}
 
-PTR(Expr) Step::expr;
-PTR(Val) Step::val;
-PTR(Env) Step::env;
+bool Step::run_until(std::chrono::steady_clock::time_point deadline) {
+    while (!run(check_interval)) {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+    }
+    return true;
+}
+
+bool Step::done() const {
+    return mode == continue_mode && conts.empty();
+}
 
 PTR(Val) Step::interp_by_steps(PTR(Expr) e) {
-    Step::mode = Step::interp_mode;
-    Step::expr = e;
-    Step::env = Env::empty;
-    Step::val = nullptr;
-    Step::cont = Cont::done;
+    Step step(e);
+    if (max_steps == 0 && time_limit.count() == 0)
+        return step.run();
 
+    long steps_left = (max_steps > 0) ? max_steps : LONG_MAX;
+    auto deadline = std::chrono::steady_clock::now() + time_limit;
     while (1) {
-        if (Step::mode == Step::interp_mode) Step::expr->step_interp();
-        else {
-            if (Step::cont == Cont::done) return Step::val;
-            else Step::cont->step_continue();
-        }
+        long slice = std::min(steps_left, check_interval);
+        if (step.run(slice))
+            return step.val;
+        steps_left -= slice;
+        if (steps_left == 0)
+            throw std::runtime_error("step limit exceeded");
+        if (time_limit.count() > 0 && std::chrono::steady_clock::now() >= deadline)
+            throw std::runtime_error("time limit exceeded");
     }
 }
+
+TEST_CASE("deep recursion by steps") {
+    Step step(parse_str("_let count = _fun (count) _fun (n) _if n == 0 _then 0 _else 1 + count(count)(n + -1)"
+                        "_in count(count)(100000)"));
+    CHECK(step.run()->equals(NEW(NumVal)(100000)));
+    CHECK(step.conts.empty());
+
+    // Programs nested too deeply for a recursive walk are resolved and run.
+    std::string sum = "1";
+    for (int i = 1; i < 200000; i++)
+        sum += " + 1";
+    CHECK(Step::interp_by_steps(parse_str(sum))->equals(NEW(NumVal)(200000)));
+    std::string lets;
+    for (int i = 0; i < 100000; i++)
+        lets += std::string("_let ") + (char) ('a' + i % 7) + " = 1 _in ";
+    CHECK(Step::interp_by_steps(parse_str(lets + "d"))->equals(NEW(NumVal)(1)));
+}
+
+TEST_CASE("suspend and resume steps") {
+    std::string sum = "_letrec sum = _fun (n) _if n == 0 _then 0 _else n + sum(n + -1) _in sum(";
+    std::vector<std::unique_ptr<Step>> steps;
+    for (int i = 0; i < 3; i++)
+        steps.push_back(std::make_unique<Step>(parse_str(sum + std::to_string(1000 * (i + 1)) + ")")));
+
+    // Take turns in small slices until every machine has finished.
+    int turns = 0;
+    for (size_t finished = 0; finished < steps.size(); turns++) {
+        finished = 0;
+        for (auto &step : steps)
+            finished += step->done() || step->run(100);
+    }
+    CHECK(turns > 100);
+    CHECK(steps[0]->val->equals(NEW(NumVal)(500500)));
+    CHECK(steps[1]->val->equals(NEW(NumVal)(2001000)));
+    CHECK(steps[2]->val->equals(NEW(NumVal)(4501500)));
+    CHECK(steps[2]->run(100));
+
+    std::string forever = "_letrec loop = _fun (n) loop(n + 1) _in loop(0)";
+    Step runaway(parse_str(forever));
+    CHECK(!runaway.run(100000));
+    CHECK(!runaway.run_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(5)));
+    CHECK(!runaway.done());
+
+    Step::max_steps = 10000;
+    CHECK_THROWS_WITH(Step::interp_by_steps(parse_str(forever)), "step limit exceeded");
+    CHECK(Step::interp_by_steps(parse_str(sum + "100)"))->equals(NEW(NumVal)(5050)));
+    Step::max_steps = 0;
+    Step::time_limit = std::chrono::milliseconds(5);
+    CHECK_THROWS_WITH(Step::interp_by_steps(parse_str(forever)), "time limit exceeded");
+    CHECK(Step::interp_by_steps(parse_str(sum + "100)"))->equals(NEW(NumVal)(5050)));
+    Step::time_limit = std::chrono::milliseconds(0);
+}
+
+TEST_CASE("step machines on separate threads") {
+    if (!values_are_thread_safe)
+        return;
+    std::string fib = "_let fib = _fun (fib) _fun (x)_if x == 0 _then 1 _else _if x == 2 + -1 _then 1 _else "
+                      "fib(fib)(x + -1) + fib(fib)(x + -2)_in fib(fib)(";
+    std::vector<PTR(Val)> results(4);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < 4; i++)
+        threads.push_back(std::thread([&, i]() {
+            results[i] = Step::interp_by_steps(parse_str(fib + std::to_string(10 + i) + ")"));
+        }));
+    for (std::thread &t : threads)
+        t.join();
+
+    CHECK(results[0]->equals(NEW(NumVal)(89)));
+    CHECK(results[1]->equals(NEW(NumVal)(144)));
+    CHECK(results[2]->equals(NEW(NumVal)(233)));
+    CHECK(results[3]->equals(NEW(NumVal)(377)));
+}
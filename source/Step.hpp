@@ -6,11 +6,13 @@
 
 #include "pointer.hpp"
 #include "Expr.hpp"
-
-class Cont;
+#include "Cont.hpp"
+#include <chrono>
+#include <vector>
 
 /**
- * The <code>Step</code> introduces the static method <code>interp_by_steps</code>.
+ * The <code>Step</code> class is a machine that evaluates an Expr one step at a time.
+ * All of the machine's state lives in the object, so separate threads can each run their own <code>Step</code>.
  */
 class Step {
 public:
@@ -19,23 +21,70 @@ public:
         continue_mode
     } mode_t;
 
-    static mode_t mode;
+    mode_t mode;
+
+    PTR(Expr) expr;
+    PTR(Env) env;
+
+    PTR(Val) val;
+
+    std::vector<Cont> conts;
+
+    /* Set once at startup to stop <code>interp_by_steps</code> after this many steps, or 0 for no limit. */
+    static long max_steps;
+    /* Set once at startup to stop <code>interp_by_steps</code> after this long, or 0 for no limit. */
+    static std::chrono::milliseconds time_limit;
 
-    static PTR(Expr) expr;
-    static PTR(Env) env;
+    /**
+     * Constructs a Step machine that is ready to evaluate an Expr.
+     * The Expr's variables are resolved to frame slots first.
+     * @param e Expr to be evaluated.
+     */
+    Step(PTR(Expr) e);
 
-    static PTR(Val) val;
+    /**
+     * Runs the machine until the evaluation finishes.
+     * /exception If the evaluation reaches a free variable, an error will be thrown.
+     * @return Val representing the Expr solution or a semantically equivalent value.
+     */
+    PTR(Val) run();
 
-    static PTR(Cont) cont;
+    /**
+     * Runs the machine for at most the given number of steps. If the evaluation has not finished by then, the machine
+     * is suspended and a later call resumes it where it stopped, so one thread can take turns running many machines.
+     * After an error is thrown the machine cannot be resumed.
+     * /exception If the evaluation reaches a free variable, an error will be thrown.
+     * @param steps most steps to take.
+     * @return true if the evaluation finished and its result is in <code>val</code>, false if it was suspended.
+     */
+    bool run(long steps);
+
+    /**
+     * Runs the machine until the evaluation finishes or the deadline passes, checking the clock every
+     * <code>check_interval</code> steps. A suspended machine can be resumed like one suspended by <code>run(long)</code>.
+     * /exception If the evaluation reaches a free variable, an error will be thrown.
+     * @param deadline when to suspend the machine.
+     * @return true if the evaluation finished and its result is in <code>val</code>, false if it was suspended.
+     */
+    bool run_until(std::chrono::steady_clock::time_point deadline);
+
+    /**
+     * @return true if the evaluation has finished and its result is in <code>val</code>.
+     */
+    bool done() const;
 
 /**
  * Evaluates the Expr and returns a Val.
  * Differs from the standard interp as this method allows the solving of deeply recursive functions without causing a
  * stack overflow.
- * /exception If the evaluation reaches a free variable, an error will be thrown.
+ * Stops with an error once <code>max_steps</code> or <code>time_limit</code> is exceeded.
+ * /exception If the evaluation reaches a free variable or exceeds a limit, an error will be thrown.
  * @param e Expr to be evaluated.
  * @return Val representing the Expr solution or a semantically equivalent value.
  */
     static PTR(Val) interp_by_steps(PTR(Expr) e);
-};
 
+private:
+    // Steps between clock checks, so a deadline is only missed by a few microseconds.
+    static constexpr long check_interval = 1024;
+};
@@ -0,0 +1,160 @@
+//
+// Bytecode compiler and stack machine for MSDscript.
+//
+
+#include "VM.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+int Bytecode::emit(opcode_t op, int arg) {
+    code.push_back({op, arg});
+    return (int) code.size() - 1;
+}
+
+int Bytecode::add_constant(PTR(Val) val) {
+    constants.push_back(val);
+    return (int) constants.size() - 1;
+}
+
+int Bytecode::add_name(const Symbol &name) {
+    auto found = index_of_name.try_emplace(name, (int) names.size());
+    if (found.second)
+        names.push_back(name);
+    return found.first->second;
+}
+
+int Bytecode::add_function(const Symbol &self_name, var_list_t formal_args, PTR(Expr) body) {
+    functions.push_back({self_name, formal_args, body});
+    return (int) functions.size() - 1;
+}
+
+Bytecode Bytecode::compile(PTR(Expr) e) {
+    Bytecode b;
+    e->compile(b);
+    b.emit(op_return);
+
+    // Function bodies are compiled after the code that refers to them,
+    // and may add more functions to the end of the list as they go.
+    for (size_t i = 0; i < b.functions.size(); i++) {
+        PTR(Expr) body = b.functions[i].body;
+        b.entry_for_body[body.get()] = (int) b.code.size();
+        body->compile(b);
+        b.emit(op_return);
+    }
+    return b;
+}
+
+PTR(Val) VM::run(const Bytecode &code) {
+    typedef struct {
+        int return_pc;
+        PTR(Env) env;
+    } frame_t;
+
+    std::vector<PTR(Val)> stack;
+    std::vector<PTR(Env)> saved_envs;
+    std::vector<frame_t> frames;
+    PTR(Env) env = Env::empty;
+    int pc = 0;
+
+    while (1) {
+        const Bytecode::instr_t &in = code.code[pc++];
+        switch (in.op) {
+            case Bytecode::op_const:
+                stack.push_back(code.constants[in.arg]);
+                break;
+            case Bytecode::op_load:
+                stack.push_back(env->lookup(code.names[in.arg]));
+                break;
+            case Bytecode::op_add: {
+                PTR(Val) rhs_val = stack.back();
+                stack.pop_back();
+                stack.back() = Val::add(stack.back(), rhs_val);
+                break;
+            }
+            case Bytecode::op_mult: {
+                PTR(Val) rhs_val = stack.back();
+                stack.pop_back();
+                stack.back() = Val::mult(stack.back(), rhs_val);
+                break;
+            }
+            case Bytecode::op_equal: {
+                PTR(Val) rhs_val = stack.back();
+                stack.pop_back();
+                stack.back() = BoolVal::make(stack.back()->equals(rhs_val));
+                break;
+            }
+            case Bytecode::op_jump:
+                pc = in.arg;
+                break;
+            case Bytecode::op_jump_if_false: {
+                PTR(Val) test_val = stack.back();
+                stack.pop_back();
+                if (!test_val->is_true())
+                    pc = in.arg;
+                break;
+            }
+            case Bytecode::op_bind:
+                saved_envs.push_back(env);
+                env = NEW(ExtendedEnv)(env, code.names[in.arg], stack.back());
+                stack.pop_back();
+                break;
+            case Bytecode::op_unbind:
+                env = saved_envs.back();
+                saved_envs.pop_back();
+                break;
+            case Bytecode::op_closure: {
+                const Bytecode::function_t &f = code.functions[in.arg];
+                stack.push_back(NEW(FunVal)(f.self_name, f.formal_args, f.body, env, -1));
+                break;
+            }
+            case Bytecode::op_call: {
+                // A call with several arguments binds them all into one frame.
+                PTR(Val) actual_arg_val;
+                std::vector<PTR(Val)> actual_arg_vals;
+                if (in.arg == 1) {
+                    actual_arg_val = stack.back();
+                    stack.pop_back();
+                } else {
+                    actual_arg_vals.assign(std::make_move_iterator(stack.end() - in.arg),
+                                           std::make_move_iterator(stack.end()));
+                    stack.resize(stack.size() - in.arg);
+                }
+                PTR(Val) to_be_called_val = stack.back();
+                stack.pop_back();
+
+                PTR(FunVal) f = CAST(FunVal)(to_be_called_val);
+                if (f == nullptr) {
+                    if (in.arg == 1)
+                        stack.push_back(to_be_called_val->call(actual_arg_val));
+                    else
+                        stack.push_back(to_be_called_val->call_with(std::move(actual_arg_vals)));
+                } else {
+                    auto entry = code.entry_for_body.find(f->body.get());
+                    if (entry == code.entry_for_body.end())
+                        throw std::runtime_error("function was not compiled to bytecode");
+                    frames.push_back({pc, env});
+                    if (in.arg == 1)
+                        env = f->bind_arg(actual_arg_val);
+                    else
+                        env = f->bind_args(std::move(actual_arg_vals));
+                    pc = entry->second;
+                }
+                break;
+            }
+            case Bytecode::op_return:
+                if (frames.empty())
+                    return stack.back();
+                pc = frames.back().return_pc;
+                env = frames.back().env;
+                frames.pop_back();
+                break;
+        }
+    }
+}
+
+TEST_CASE("vm") {
+    CHECK(VM::run(Bytecode::compile(parse_str("_let f = _fun (x) x*x _in f(2)")))->equals(NEW(NumVal)(4)));
+    CHECK(VM::run(Bytecode::compile(parse_str("_let count = _fun (count) _fun (n) _if n == 0 _then 0 _else "
+                                              "1 + count(count)(n + -1) _in count(count)(100000)")))
+                  ->to_string() == "100000");
+}
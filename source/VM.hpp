@@ -0,0 +1,85 @@
+//
+// Bytecode compiler and stack machine for MSDscript.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "pointer.hpp"
+#include "Expr.hpp"
+
+/**
+ * The <code>Bytecode</code> class holds an Expr lowered into a flat list of instructions.
+ * The program itself starts at offset 0, and every function body is appended after it.
+ */
+class Bytecode {
+public:
+    typedef enum {
+        op_const,         // push constants[arg]
+        op_load,          // push the value of names[arg]
+        op_add,           // pop rhs and lhs, push lhs + rhs
+        op_mult,          // pop rhs and lhs, push lhs * rhs
+        op_equal,         // pop rhs and lhs, push lhs == rhs
+        op_jump,          // continue at arg
+        op_jump_if_false, // pop a test value, continue at arg if it is not true
+        op_bind,          // pop a value and bind it to names[arg]
+        op_unbind,        // drop the most recent binding
+        op_closure,       // push a closure for functions[arg]
+        op_call,          // pop arg arguments and a value to call, then call it
+        op_return         // return the value on top of the stack
+    } opcode_t;
+
+    typedef struct {
+        opcode_t op;
+        int arg;
+    } instr_t;
+
+    typedef struct {
+        Symbol self_name;
+        var_list_t formal_args;
+        PTR(Expr) body;
+    } function_t;
+
+    std::vector<instr_t> code;
+    std::vector<PTR(Val)> constants;
+    std::vector<Symbol> names;
+    std::unordered_map<Symbol, int> index_of_name;
+    std::vector<function_t> functions;
+    std::unordered_map<Expr *, int> entry_for_body;
+
+    /**
+     * Appends an instruction to the code.
+     * @param op operation to perform.
+     * @param arg operand of the operation.
+     * @return offset of the new instruction, so jumps can be patched.
+     */
+    int emit(opcode_t op, int arg = 0);
+    int add_constant(PTR(Val) val);
+    int add_name(const Symbol &name);
+    int add_function(const Symbol &self_name, var_list_t formal_args, PTR(Expr) body);
+
+    /**
+     * Compiles an Expr, along with every function it contains, into Bytecode.
+     * @param e Expr to compile.
+     * @return Bytecode that can be run by <code>VM::run</code>.
+     */
+    static Bytecode compile(PTR(Expr) e);
+};
+
+/**
+ * The <code>VM</code> class runs Bytecode with an explicit value stack and call stack.
+ */
+class VM {
+public:
+/**
+ * Evaluates compiled Bytecode and returns a Val.
+ * Produces the same result as <code>interp</code> on the Expr the Bytecode was compiled from. Calls do not
+ * grow the C++ stack.
+ * /exception If the evaluation reaches a free variable, an error will be thrown.
+ * @param code Bytecode to be evaluated.
+ * @return Val representing the Expr solution or a semantically equivalent value.
+ */
+    static PTR(Val) run(const Bytecode &code);
+};
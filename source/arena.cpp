@@ -0,0 +1,64 @@
+//
+// Bump allocation for nodes that are freed together.
+//
+
+#include "arena.hpp"
+#include <cstdint>
+#include <sstream>
+#include "parser.hpp"
+#include "catch.hpp"
+
+Arena::Arena(size_t block_size) {
+    this->next = nullptr;
+    this->end = nullptr;
+    this->block_size = block_size;
+    this->used = 0;
+}
+
+Arena::~Arena() {
+    for (char *block : blocks)
+        delete[] block;
+}
+
+void *Arena::allocate(size_t size, size_t align) {
+    uintptr_t p = ((uintptr_t) next + align - 1) & ~(uintptr_t) (align - 1);
+
+    if (next == nullptr || p + size > (uintptr_t) end) {
+        // Oversized requests get a block of their own.
+        size_t n = size + align > block_size ? size + align : block_size;
+        char *block = new char[n];
+        blocks.push_back(block);
+        next = block;
+        end = block + n;
+        p = ((uintptr_t) next + align - 1) & ~(uintptr_t) (align - 1);
+    }
+
+    next = (char *) (p + size);
+    used += size;
+    return (void *) p;
+}
+
+size_t Arena::bytes_used() {
+    return used;
+}
+
+TEST_CASE("arena") {
+    PTR(Arena) arena = NEW(Arena)(256);
+    arena->allocate(3, 1);
+    CHECK((uintptr_t) arena->allocate(8, 8) % 8 == 0);
+    CHECK(arena->allocate(1000, 8) != nullptr);
+    CHECK(arena->bytes_used() == 1011);
+
+    std::string fib = "_let fib = _fun (fib) _fun (x)_if x == 0 _then 1 _else _if x == 2 + -1 _then 1 _else "
+                      "fib(fib)(x + -1) + fib(fib)(x + -2)_in fib(fib)(10)";
+    PTR(Arena) parse_arena = NEW(Arena)();
+    std::istringstream in(fib);
+    PTR(Expr) e = parse(in, parse_arena);
+    CHECK(parse_arena->bytes_used() > 0);
+    CHECK(e->equals(parse_str(fib)));
+
+    // The nodes keep their arena alive after the parser's caller lets go of it.
+    parse_arena = nullptr;
+    CHECK(e->interp(Env::empty)->equals(NEW(NumVal)(89)));
+    CHECK(e->optimize()->equals(parse_str(fib)->optimize()));
+}
@@ -0,0 +1,78 @@
+//
+// Bump allocation for nodes that are freed together.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "pointer.hpp"
+
+/**
+ * An <code>Arena</code> hands out memory from large blocks by bumping a pointer, and releases all of it at once
+ * when it is destroyed. Nodes are allocated into one with <code>ARENA_NEW(arena, T, args...)</code>.
+ */
+class Arena ENABLE_THIS(Arena) {
+public:
+    /**
+     * Constructs an empty Arena.
+     * @param block_size number of bytes to reserve each time the current block runs out.
+     */
+    Arena(size_t block_size = 64 * 1024);
+    ~Arena();
+
+    /**
+     * Returns uninitialized memory that stays valid until the Arena is destroyed.
+     * @param size number of bytes needed.
+     * @param align alignment the memory must have.
+     * @return pointer to the memory.
+     */
+    void *allocate(size_t size, size_t align);
+
+    /**
+     * Returns the number of bytes handed out so far.
+     * @return bytes allocated from this Arena.
+     */
+    size_t bytes_used();
+
+private:
+    std::vector<char *> blocks;
+    char *next;
+    char *end;
+    size_t block_size;
+    size_t used;
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+};
+
+/**
+ * Standard allocator over an Arena. Every node allocated through it keeps the Arena alive, so the Arena's
+ * blocks are released when the last of its nodes is destroyed.
+ */
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    PTR(Arena) arena;
+
+    ArenaAllocator(PTR(Arena) arena) : arena(arena) { }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) { }
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        // Memory goes back when the whole Arena is destroyed.
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
@@ -0,0 +1,192 @@
+//
+// Benchmarks for the MSDscript evaluators, built as msdscript_bench.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "pointer.hpp"
+#include "Expr.hpp"
+#include "parser.hpp"
+#include "driver.hpp"
+
+// Every allocation in the process goes through these, so the
+// benchmarks can report how many allocations each run makes. Parallel
+// rows allocate from the pool's threads too.
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+typedef struct {
+    std::string name;
+    std::function<PTR(Expr)()> build;
+} workload_t;
+
+typedef struct {
+    const char *name;
+    run_mode_t mode;
+} bench_mode_t;
+
+// _let x0 = 1 _in _let x1 = x0 + 1 _in ... x<n-1>
+static PTR(Expr) let_chain(int n) {
+    PTR(Expr) e = NEW(VarExpr)("x" + std::to_string(n - 1));
+    for (int i = n - 1; i > 0; i--)
+        e = NEW(LetExpr)("x" + std::to_string(i),
+                         NEW(AddExpr)(NEW(VarExpr)("x" + std::to_string(i - 1)), NEW(NumExpr)(1)), e);
+    return NEW(LetExpr)("x0", NEW(NumExpr)(1), e);
+}
+
+// A balanced tree of additions and multiplications with 2^depth leaves,
+// alternating between numbers and the variable var. With var bound to 1,
+// no intermediate result overflows an int64_t.
+static PTR(Expr) wide_tree(int depth, std::string var, int &leaf) {
+    if (depth == 0) {
+        leaf++;
+        if (leaf % 2)
+            return NEW(NumExpr)(leaf % 3 - 1);
+        return NEW(VarExpr)(var);
+    }
+    PTR(Expr) lhs = wide_tree(depth - 1, var, leaf);
+    PTR(Expr) rhs = wide_tree(depth - 1, var, leaf);
+    if (depth % 2)
+        return NEW(AddExpr)(lhs, rhs);
+    return NEW(MultExpr)(lhs, rhs);
+}
+
+static std::vector<workload_t> workloads() {
+    std::vector<workload_t> w;
+
+    w.push_back({"let chain (1000)", [] { return let_chain(1000); }});
+    w.push_back({"self-applied fib (18)", [] { return parse_str(
+            "_let fib = _fun (fib) _fun (x) _if x == 0 _then 1 _else _if x == 1 _then 1"
+            "  _else fib(fib)(x + -1) + fib(fib)(x + -2)"
+            "_in fib(fib)(18)"); }});
+    w.push_back({"letrec fib (18)", [] { return parse_str(
+            "_letrec fib = _fun (x) _if x == 0 _then 1 _else _if x == 1 _then 1"
+            "  _else fib(x + -1) + fib(x + -2)"
+            "_in fib(18)"); }});
+    w.push_back({"Y combinator count (1000)", [] { return parse_str(
+            "_let Y = _fun (f) (_fun (x) f(_fun (v) x(x)(v)))(_fun (x) f(_fun (v) x(x)(v)))"
+            "_in _let count = Y(_fun (count) _fun (n) _if n == 0 _then 0 _else 1 + count(n + -1))"
+            "_in count(1000)"); }});
+    w.push_back({"tail loop (10000)", [] { return parse_str(
+            "_let loop = _fun (loop) _fun (n) _if n == 0 _then 0 _else loop(loop)(n + -1)"
+            "_in loop(loop)(10000)"); }});
+    w.push_back({"curried 4-arg calls (1000)", [] { return parse_str(
+            "_let f = _fun (a) _fun (b) _fun (c) _fun (d) a + b + c + d"
+            "_in _let loop = _fun (loop) _fun (n) _if n == 0 _then 0 _else f(n)(1)(2)(3) + loop(loop)(n + -1)"
+            "_in loop(loop)(1000)"); }});
+    w.push_back({"n-ary 4-arg calls (1000)", [] { return parse_str(
+            "_let f = _fun (a, b, c, d) a + b + c + d"
+            "_in _let loop = _fun (loop, n) _if n == 0 _then 0 _else f(n, 1, 2, 3) + loop(loop, n + -1)"
+            "_in loop(loop, 1000)"); }});
+    w.push_back({"wide arithmetic (2^14)", [] {
+        int leaf = 0;
+        return (PTR(Expr)) NEW(LetExpr)("x", NEW(NumExpr)(1), wide_tree(14, "x", leaf));
+    }});
+    w.push_back({"free variable tree (2^14)", [] {
+        int leaf = 1 << 14;
+        return wide_tree(14, "y", leaf);
+    }});
+    return w;
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// Runs one workload in one mode for at least min_time, and prints a row.
+static void measure(const workload_t &w, const bench_mode_t &m) {
+    const auto min_time = std::chrono::milliseconds(300);
+    std::string result;
+    PTR(Expr) e = w.build();
+
+    try {
+        result = run_program(e, m.mode);
+    } catch (const std::runtime_error &error) {
+        printf("%-28s %-8s %s\n", w.name.c_str(), m.name, error.what());
+        return;
+    }
+
+    size_t ops = 0;
+    size_t op_allocations = 0;
+    std::chrono::steady_clock::duration elapsed{0};
+    do {
+        // Optimized Exprs remember their results, so each optimize gets a
+        // fresh tree, built and torn down outside of the measurement.
+        if (m.mode == optimize_mode)
+            e = w.build();
+        size_t allocations_before = allocations;
+        auto start = std::chrono::steady_clock::now();
+        result = run_program(e, m.mode);
+        elapsed += std::chrono::steady_clock::now() - start;
+        op_allocations += allocations - allocations_before;
+        ops++;
+    } while (elapsed < min_time);
+
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    printf("%-28s %-8s %14.0f %14.1f %12ld\n", w.name.c_str(), m.name, ns / ops,
+           (double) op_allocations / ops, peak_rss_kb());
+}
+
+int main(int argc, char **argv) {
+    const bench_mode_t modes[] = {
+            {"interp", interp_mode},
+            {"step", step_mode},
+            {"optimize", optimize_mode},
+            {"vm", vm_mode},
+            {"compiled", compiled_mode},
+            {"parallel", parallel_mode}
+    };
+    // Only rows whose workload or mode contains this are run.
+    const char *filter = (argc > 1) ? argv[1] : "";
+
+    printf("%-28s %-8s %14s %14s %12s\n", "workload", "mode", "ns/op", "allocs/op", "peak RSS KB");
+    fflush(stdout);
+
+    std::vector<workload_t> all = workloads();
+    for (const workload_t &w : all) {
+        for (const bench_mode_t &m : modes) {
+            if (!strstr(w.name.c_str(), filter) && !strstr(m.name, filter))
+                continue;
+            // Each row runs in its own process, so its peak RSS is its own.
+            pid_t pid = fork();
+            if (pid == 0) {
+                measure(w, m);
+                fflush(stdout);
+                _exit(0);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+//
+// Arbitrary-precision integers for numbers that overflow int64_t.
+//
+
+#include <algorithm>
+#include "bignum.hpp"
+#include "catch.hpp"
+
+BigInt::BigInt() {
+    this->negative = false;
+}
+
+BigInt::BigInt(int64_t n) {
+    this->negative = n < 0;
+    // Negating as unsigned also works for the most negative int64_t.
+    uint64_t magnitude = negative ? -(uint64_t) n : (uint64_t) n;
+    while (magnitude > 0) {
+        limbs.push_back((uint32_t) (magnitude % base));
+        magnitude /= base;
+    }
+}
+
+BigInt BigInt::parse(std::string_view digits, bool negative) {
+    BigInt n;
+    // Each limb takes up to nine digits, starting from the end.
+    for (size_t end = digits.size(); end > 0; end = (end > 9) ? end - 9 : 0) {
+        size_t start = (end > 9) ? end - 9 : 0;
+        uint32_t limb = 0;
+        for (size_t i = start; i < end; i++)
+            limb = limb * 10 + (digits[i] - '0');
+        n.limbs.push_back(limb);
+    }
+    n.negative = negative;
+    n.trim();
+    return n;
+}
+
+void BigInt::trim() {
+    while (!limbs.empty() && limbs.back() == 0)
+        limbs.pop_back();
+    if (limbs.empty())
+        negative = false;
+}
+
+int BigInt::compare_magnitudes(const BigInt &a, const BigInt &b) {
+    if (a.limbs.size() != b.limbs.size())
+        return (a.limbs.size() < b.limbs.size()) ? -1 : 1;
+    for (size_t i = a.limbs.size(); i > 0; i--) {
+        if (a.limbs[i - 1] != b.limbs[i - 1])
+            return (a.limbs[i - 1] < b.limbs[i - 1]) ? -1 : 1;
+    }
+    return 0;
+}
+
+BigInt BigInt::operator+(const BigInt &other) const {
+    BigInt sum;
+    if (negative == other.negative) {
+        sum.negative = negative;
+        uint32_t carry = 0;
+        for (size_t i = 0; i < std::max(limbs.size(), other.limbs.size()) || carry; i++) {
+            uint32_t limb = carry;
+            if (i < limbs.size())
+                limb += limbs[i];
+            if (i < other.limbs.size())
+                limb += other.limbs[i];
+            carry = limb >= base;
+            sum.limbs.push_back(carry ? limb - base : limb);
+        }
+    } else {
+        // Subtract the smaller magnitude from the larger, keeping the larger's sign.
+        const BigInt &larger = (compare_magnitudes(*this, other) >= 0) ? *this : other;
+        const BigInt &smaller = (&larger == this) ? other : *this;
+        sum.negative = larger.negative;
+        int64_t borrow = 0;
+        for (size_t i = 0; i < larger.limbs.size(); i++) {
+            int64_t limb = (int64_t) larger.limbs[i] - borrow - (i < smaller.limbs.size() ? smaller.limbs[i] : 0);
+            borrow = limb < 0;
+            sum.limbs.push_back((uint32_t) (borrow ? limb + base : limb));
+        }
+    }
+    sum.trim();
+    return sum;
+}
+
+BigInt BigInt::operator*(const BigInt &other) const {
+    BigInt product;
+    product.negative = negative != other.negative;
+    product.limbs.assign(limbs.size() + other.limbs.size(), 0);
+    for (size_t i = 0; i < limbs.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < other.limbs.size() || carry; j++) {
+            uint64_t limb = product.limbs[i + j] + carry;
+            if (j < other.limbs.size())
+                limb += (uint64_t) limbs[i] * other.limbs[j];
+            product.limbs[i + j] = (uint32_t) (limb % base);
+            carry = limb / base;
+        }
+    }
+    product.trim();
+    return product;
+}
+
+bool BigInt::operator==(const BigInt &other) const {
+    return negative == other.negative && limbs == other.limbs;
+}
+
+bool BigInt::to_int64(int64_t &n) const {
+    uint64_t magnitude = 0;
+    for (size_t i = limbs.size(); i > 0; i--) {
+        if (__builtin_mul_overflow(magnitude, base, &magnitude)
+            || __builtin_add_overflow(magnitude, limbs[i - 1], &magnitude))
+            return false;
+    }
+    // The most negative int64_t has one more unit of magnitude than the most positive.
+    if (magnitude > (uint64_t) INT64_MAX + negative)
+        return false;
+    n = negative ? (int64_t) -magnitude : (int64_t) magnitude;
+    return true;
+}
+
+std::string BigInt::to_string() const {
+    if (limbs.empty())
+        return "0";
+    std::string s = negative ? "-" : "";
+    s += std::to_string(limbs.back());
+    for (size_t i = limbs.size() - 1; i > 0; i--) {
+        std::string limb = std::to_string(limbs[i - 1]);
+        s += std::string(9 - limb.size(), '0') + limb;
+    }
+    return s;
+}
+
+TEST_CASE("BigInt") {
+    CHECK(BigInt(0).to_string() == "0");
+    CHECK(BigInt(INT64_MIN).to_string() == "-9223372036854775808");
+    CHECK(BigInt::parse("000123", true).to_string() == "-123");
+    CHECK(BigInt::parse("0", true).to_string() == "0");
+
+    BigInt max = BigInt(INT64_MAX);
+    CHECK((max + BigInt(1)).to_string() == "9223372036854775808");
+    CHECK((max * max).to_string() == "85070591730234615847396907784232501249");
+    CHECK((max * BigInt(-1) + BigInt(-1)).to_string() == "-9223372036854775808");
+    CHECK((BigInt::parse("1000000000000000000000", false) + BigInt(-1)).to_string() == "999999999999999999999");
+    CHECK((BigInt(-5) + BigInt(5)) == BigInt(0));
+    CHECK(BigInt(-5) * BigInt(0) == BigInt(0));
+
+    CHECK([&] { int64_t n; return (max * BigInt(-1) + BigInt(-1)).to_int64(n) && n == INT64_MIN; }());
+    CHECK([&] { int64_t n; return !(max + BigInt(1)).to_int64(n); }());
+    CHECK([&] { int64_t n; return !(max * max).to_int64(n); }());
+}
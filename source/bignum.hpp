@@ -0,0 +1,60 @@
+//
+// Arbitrary-precision integers for numbers that overflow int64_t.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A <code>BigInt</code> is an integer of any size, stored as a sign and a magnitude in base 10^9 so that
+ * printing and parsing are simple. It is only used once a number no longer fits in an int64_t.
+ */
+class BigInt {
+public:
+    /**
+     * Constructs a BigInt equal to an int64_t.
+     * @param n value of the BigInt.
+     */
+    BigInt(int64_t n);
+
+    /**
+     * Parses a string of decimal digits.
+     * @param digits one or more characters from '0' to '9'.
+     * @param negative true if the number is negated.
+     * @return BigInt with the value of the digits.
+     */
+    static BigInt parse(std::string_view digits, bool negative);
+
+    BigInt operator+(const BigInt &other) const;
+    BigInt operator*(const BigInt &other) const;
+    bool operator==(const BigInt &other) const;
+
+    /**
+     * Converts the BigInt to an int64_t if it is in range.
+     * @param n set to the value of the BigInt if it fits.
+     * @return true if the value fits in an int64_t, false otherwise.
+     */
+    bool to_int64(int64_t &n) const;
+
+    /**
+     * Returns the BigInt in decimal.
+     * @return String of the BigInt.
+     */
+    std::string to_string() const;
+
+private:
+    static const uint32_t base = 1000000000;
+
+    // Least significant limb first, with no high zero limbs, so zero has
+    // no limbs at all and is never negative.
+    bool negative;
+    std::vector<uint32_t> limbs;
+
+    BigInt();
+    void trim();
+    static int compare_magnitudes(const BigInt &a, const BigInt &b);
+};
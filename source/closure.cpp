@@ -0,0 +1,28 @@
+//
+// Compiles MSDscript programs into trees of C++ closures.
+//
+
+#include "closure.hpp"
+#include "scope.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+PTR(Val) run_compiled(PTR(Expr) e) {
+    Scope scope(nullptr);
+    compiled_t code = e->resolve(scope)->compile_closure();
+    return code(NEW(FrameEnv)(Env::empty, scope.frame_size));
+}
+
+TEST_CASE("compile_closure") {
+    // A compiled function keeps its code when it is called from outside compiled code.
+    PTR(Val) times_y = run_compiled(parse_str("_let y = 2 _in _fun (x) x * y"));
+    CHECK(times_y->call(NEW(NumVal)(5))->equals(NEW(NumVal)(10)));
+
+    // Calls in tail position do not grow the C++ stack.
+    CHECK(run_compiled(parse_str("_letrec f = _fun (n) _if n == 0 _then 0 _else f(n + -1) _in f(100000)"))
+                  ->to_string() == "0");
+    CHECK(run_compiled(parse_str("_letrec f = _fun (n, acc) _if n == 0 _then acc _else _let m = n + -1"
+                                 " _in f(m, acc + n) _in f(100000, 0)"))->to_string() == "5000050000");
+    CHECK_THROWS_WITH(run_compiled(parse_str("_letrec f = _fun (n) _if n == 0 _then 0 _else f(n + -1) _in f(_true)")),
+                      "no adding booleans");
+}
@@ -0,0 +1,19 @@
+//
+// Compiles MSDscript programs into trees of C++ closures.
+//
+
+#pragma once
+
+#include "pointer.hpp"
+#include "Expr.hpp"
+
+/**
+ * Resolves an Expr's variables to frame slots, compiles it with <code>compile_closure</code>, and runs it.
+ * Each node becomes a closure that calls its children's closures directly, so running it makes no virtual calls
+ * on Exprs and looks up no variables by name except free ones.
+ * Produces the same result as <code>interp(Env::empty)</code>.
+ * /exception If the evaluation reaches a free variable, an error will be thrown.
+ * @param e Expr to be evaluated.
+ * @return Val representing the Expr solution or a semantically equivalent value.
+ */
+PTR(Val) run_compiled(PTR(Expr) e);
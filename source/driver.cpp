@@ -0,0 +1,171 @@
+//
+// Runs MSDscript programs in each of the command line modes.
+//
+
+#include <algorithm>
+#include <sstream>
+#include "driver.hpp"
+#include "parser.hpp"
+#include "Step.hpp"
+#include "VM.hpp"
+#include "closure.hpp"
+#include "parallel.hpp"
+#include "scope.hpp"
+#include "arena.hpp"
+#include "expr_factory.hpp"
+#include "catch.hpp"
+
+std::string run_program(PTR(Expr) e, run_mode_t mode) {
+    switch (mode) {
+        case optimize_mode:
+            return e->optimize()->expr_print();
+        case step_mode:
+            return Step::interp_by_steps(e)->to_string();
+        case vm_mode:
+            return VM::run(Bytecode::compile(e))->to_string();
+        case compiled_mode:
+            return run_compiled(e)->to_string();
+        case parallel_mode:
+            return ForkJoin::shared().run(e)->to_string();
+        default:
+            return interp_resolved(e)->to_string();
+    }
+}
+
+// Runs one program of a batch, writing its result or its error.
+static bool run_batch_item(std::string_view program, std::ostream &out, run_mode_t mode, ExprFactory *factory) {
+    if (program.find_first_not_of(" \t\r\n") == std::string_view::npos)
+        return true;
+    try {
+        PTR(Expr) e = (factory != nullptr) ? parse(program, *factory) : parse(program, NEW(Arena)());
+        out << run_program(e, mode) << "\n";
+        return true;
+    } catch (const std::runtime_error &error) {
+        out << "error: " << error.what() << "\n";
+        return false;
+    }
+}
+
+bool run_batch(std::istream &in, std::ostream &out, run_mode_t mode, char delim, ExprFactory *factory) {
+    bool all_ok = true;
+    std::string program;
+
+    while (std::getline(in, program, delim))
+        all_ok = run_batch_item(program, out, mode, factory) && all_ok;
+    out.flush();
+    return all_ok;
+}
+
+bool run_batch(std::string_view text, std::ostream &out, run_mode_t mode, char delim, ExprFactory *factory) {
+    bool all_ok = true;
+
+    while (!text.empty()) {
+        size_t end = text.find(delim);
+        if (end == std::string_view::npos)
+            end = text.size();
+        all_ok = run_batch_item(text.substr(0, end), out, mode, factory) && all_ok;
+        text.remove_prefix(std::min(end + 1, text.size()));
+    }
+    out.flush();
+    return all_ok;
+}
+
+// The tests and their helpers are left out of builds without tests.
+#ifndef CATCH_CONFIG_DISABLE
+
+/* for tests */
+static std::string batch_str(std::string s, run_mode_t mode, char delim = '\n') {
+    std::istringstream in(s);
+    std::ostringstream out;
+    run_batch(in, out, mode, delim);
+    return out.str();
+}
+
+/* for tests */
+static std::string interp_str(std::string s) {
+    try {
+        return parse_str(s)->interp(Env::empty)->to_string();
+    } catch (const std::runtime_error &exn) {
+        return exn.what();
+    }
+}
+
+/* for tests */
+static std::string run_str(std::string s, run_mode_t mode) {
+    try {
+        // An optimized program is printed, and a printed `==` inside
+        // parentheses does not parse, so evaluate the optimized Expr.
+        if (mode == optimize_mode)
+            return parse_str(s)->optimize()->interp(Env::empty)->to_string();
+        return run_program(parse_str(s), mode);
+    } catch (const std::runtime_error &exn) {
+        return exn.what();
+    }
+}
+
+TEST_CASE("modes agree with interp") {
+    std::string programs[] = {
+            " 3 ", " 3+4 ", " 3*4 ", " 3*x ", " 3+x ", " 3+x*12 ", " _let x = 5 _in 3 * x + 3", " _true", " _false",
+            "_if 10 == 5 _then 3 _else 4", "_if 10 == 10 _then 3 + 10 _else 4", "_if 10 == 11 _then 3 + 10 _else 4 * 30",
+            "_if _true _then 1 _else 0", " 2 == 1+1", " 1 == 1", "_if 7 == _true _then 8 _else 1", " x == x",
+            "_if 7 _then 8 _else 1", "_true + 1", "_true * 1", "_fun (x) x + 3", "(_fun (x) x + 10)(1)",
+            "(10)(1 + y)", "_let f = _fun (x) x*x _in f(2)",
+            "_let y = 8 _in _let f = _fun (x) x*y _in f(2)", "_let f = (_fun (x) (_fun (y) x*x + y*y)) _in (f(2))(3)",
+            "_let f = _fun (x) _fun (y) x*x + y*y _in f(2)(3)", "_let x = 1 _in (_let x = 2 _in x) + x",
+            "_let x = 1 _in _let f = _fun (y) x + y _in _let x = 10 _in f(x)",
+            "_let f = _fun (x) _let y = x + 1 _in _fun (z) x + y + z _in f(1)(2) + f(10)(20)",
+            "_let fib = _fun (fib) _fun (x)_if x == 0 _then 1 _else _if x == 2 + -1 _then 1 _else fib(fib)(x + -1) + fib(fib)(x + -2)_in fib(fib)(10)",
+            "_let f = _fun (x) 2 _in f(y)", "(_fun (x) x)(_fun (y) y) == (_fun (y) y)"
+    };
+    run_mode_t modes[] = {interp_mode, optimize_mode, step_mode, vm_mode, compiled_mode, parallel_mode};
+
+    for (run_mode_t mode : modes)
+        for (std::string p : programs)
+            CHECK(run_str(p, mode) == interp_str(p));
+
+    // Calling a value that is not a function gives the value back,
+    // except by steps, where it is an error.
+    std::string non_function_calls[] = {"(10)(1)", "(10 + 5)(1)", "(_true)(1)", "(_false)(1)"};
+    for (run_mode_t mode : modes)
+        for (std::string p : non_function_calls)
+            if (mode != step_mode)
+                CHECK(run_str(p, mode) == interp_str(p));
+}
+
+TEST_CASE("batch") {
+    std::string programs = "1 + 2\n"
+                           "\n"
+                           "_let x = 5 _in x * x\n"
+                           "y + 1\n"
+                           "_true + 1\n"
+                           "(_fun (x) x + 10)(1)\n"
+                           "(1\n"
+                           "2 == 1 + 1\n";
+    std::string results = "3\n25\nerror: free variable: y\nerror: no adding booleans\n11\n"
+                          "error: expected a close parenthesis\n_true\n";
+
+    CHECK(batch_str(programs, interp_mode) == results);
+    CHECK(batch_str(programs, step_mode) == results);
+    CHECK(batch_str(programs, vm_mode) == results);
+    CHECK(batch_str(programs, parallel_mode) == results);
+    CHECK(batch_str("x + 1 + 2\n_let x = 5 _in x + y\n(1\n", optimize_mode)
+          == "(x + 3)\n(5 + y)\nerror: expected a close parenthesis\n");
+
+    CHECK(batch_str("_let x = 2\n_in x * 3;1 + 1; ;_true", interp_mode, ';') == "6\n2\n_true\n");
+
+    std::istringstream in("1\n_false + 1\n2");
+    std::ostringstream out;
+    CHECK(run_batch(in, out, interp_mode) == false);
+    CHECK(out.str() == "1\nerror: no adding booleans\n2\n");
+
+    std::ostringstream from_memory;
+    CHECK(run_batch(std::string_view(programs), from_memory, interp_mode) == false);
+    CHECK(from_memory.str() == results);
+
+    ExprFactory factory;
+    std::ostringstream shared;
+    CHECK(run_batch(std::string_view(programs), shared, interp_mode, '\n', &factory) == false);
+    CHECK(shared.str() == results);
+}
+
+#endif
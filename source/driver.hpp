@@ -0,0 +1,57 @@
+//
+// Runs MSDscript programs in each of the command line modes.
+//
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "pointer.hpp"
+#include "Expr.hpp"
+
+class ExprFactory;
+
+typedef enum {
+    interp_mode,
+    optimize_mode,
+    step_mode,
+    vm_mode,
+    compiled_mode,
+    parallel_mode
+} run_mode_t;
+
+/**
+ * Runs a parsed program in the given mode and returns what the command line prints for it.
+ * /exception If the program cannot be evaluated, an error will be thrown.
+ * @param e Expr to run.
+ * @param mode how to run it.
+ * @return printed Val, or the printed Expr for <code>optimize_mode</code>.
+ */
+std::string run_program(PTR(Expr) e, run_mode_t mode);
+
+/**
+ * Reads programs separated by a delimiter and runs each of them, writing one line per program in order.
+ * A program that fails to parse or evaluate produces an "error: " line instead of ending the batch.
+ * Programs that are only whitespace are skipped.
+ * @param in stream to read programs from.
+ * @param out stream to write results to.
+ * @param mode how to run each program.
+ * @param delim character that ends each program.
+ * @param factory ExprFactory to share subtrees across the whole batch through, or nullptr.
+ * @return true if every program ran without an error, false otherwise.
+ */
+bool run_batch(std::istream &in, std::ostream &out, run_mode_t mode, char delim = '\n',
+               ExprFactory *factory = nullptr);
+
+/**
+ * Runs a batch of programs that is already in memory, such as a mapped file, without copying it.
+ * @param text programs separated by delim.
+ * @param out stream to write results to.
+ * @param mode how to run each program.
+ * @param delim character that ends each program.
+ * @param factory ExprFactory to share subtrees across the whole batch through, or nullptr.
+ * @return true if every program ran without an error, false otherwise.
+ */
+bool run_batch(std::string_view text, std::ostream &out, run_mode_t mode, char delim = '\n',
+               ExprFactory *factory = nullptr);
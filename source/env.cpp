@@ -2,21 +2,83 @@
 // Created by Austin Cunliffe on 3/2/20.
 //
 
+#include <stdexcept>
 #include "env.hpp"
+#include "teardown.hpp"
 
-PTR(Val) EmptyEnv::lookup(std::string find_name) {
-    throw std::runtime_error("free variable: " + find_name);
+PTR(Val) EmptyEnv::lookup(const Symbol &find_name) {
+    throw std::runtime_error("free variable: " + find_name.str());
 }
 
-ExtendedEnv::ExtendedEnv(PTR(Env) env, std::string var, PTR(Val) rhs_val) {
+PTR(Val) EmptyEnv::lookup(int depth, int slot) {
+    throw std::runtime_error("no frame for a resolved variable");
+}
+
+void EmptyEnv::bind(int slot, PTR(Val) val) {
+    throw std::runtime_error("no frame for a resolved variable");
+}
+
+ExtendedEnv::ExtendedEnv(PTR(Env) env, const Symbol &var, PTR(Val) rhs_val) {
     this->rest = env;
     this->name = var;
     this->val = rhs_val;
 }
 
-PTR(Val) ExtendedEnv::lookup(std::string find_name) {
+ExtendedEnv::~ExtendedEnv() {
+    Teardown::release(val);
+    Teardown::release(rest);
+}
+
+PTR(Val) ExtendedEnv::lookup(const Symbol &find_name) {
     if (name == find_name)
         return val;
     else
         return rest->lookup(find_name);
-}
\ No newline at end of file
+}
+
+PTR(Val) ExtendedEnv::lookup(int depth, int slot) {
+    throw std::runtime_error("no frame for a resolved variable");
+}
+
+void ExtendedEnv::bind(int slot, PTR(Val) val) {
+    throw std::runtime_error("no frame for a resolved variable");
+}
+
+FrameEnv::FrameEnv(PTR(Env) env, int size) {
+    this->rest = env;
+    this->slots.resize(size);
+}
+
+FrameEnv::FrameEnv(PTR(Env) env, var_list_t names, std::vector<PTR(Val)> slots) {
+    this->rest = env;
+    this->names = names;
+    this->slots = std::move(slots);
+}
+
+FrameEnv::~FrameEnv() {
+    for (PTR(Val) &val : slots)
+        Teardown::release(val);
+    Teardown::release(rest);
+}
+
+// A resolved frame has no names, since only free variables are still
+// looked up by name. Later names shadow earlier ones, as nested
+// functions would.
+PTR(Val) FrameEnv::lookup(const Symbol &find_name) {
+    if (names != nullptr)
+        for (size_t i = names->size(); i > 0; i--)
+            if ((*names)[i - 1] == find_name)
+                return slots[i - 1];
+    return rest->lookup(find_name);
+}
+
+PTR(Val) FrameEnv::lookup(int depth, int slot) {
+    if (depth == 0)
+        return slots[slot];
+    else
+        return rest->lookup(depth - 1, slot);
+}
+
+void FrameEnv::bind(int slot, PTR(Val) val) {
+    slots[slot] = val;
+}
@@ -4,29 +4,60 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
 #include "pointer.hpp"
+#include "symbol.hpp"
 #include "value.hpp"
 
 class Env ENABLE_THIS(Env){
 public:
-    virtual PTR(Val) lookup(std::string find_name) = 0;
+    virtual PTR(Val) lookup(const Symbol &find_name) = 0;
+    virtual PTR(Val) lookup(int depth, int slot) = 0;
+    virtual void bind(int slot, PTR(Val) val) = 0;
     static PTR(Env) empty;
 };
 
 
 class EmptyEnv: public Env {
 public:
-    PTR(Val) lookup(std::string find_name);
+    PTR(Val) lookup(const Symbol &find_name);
+    PTR(Val) lookup(int depth, int slot);
+    void bind(int slot, PTR(Val) val);
 };
 
 
 class ExtendedEnv: public Env {
 public:
-    std::string name;
+    Symbol name;
     PTR(Val) val;
     PTR(Env) rest;
 
-    ExtendedEnv(PTR(Env) env, std::string var, PTR(Val) rhs_val);
+    ExtendedEnv(PTR(Env) env, const Symbol &var, PTR(Val) rhs_val);
+    ~ExtendedEnv();
 
-    PTR(Val) lookup(std::string find_name);
-};
\ No newline at end of file
+    PTR(Val) lookup(const Symbol &find_name);
+    PTR(Val) lookup(int depth, int slot);
+    void bind(int slot, PTR(Val) val);
+};
+
+/**
+ * A <code>FrameEnv</code> holds every variable bound by one function call, or by the top level of a program,
+ * in numbered slots. Variables rewritten by <code>Expr::resolve</code> are found by how many frames out they
+ * are and which slot they are in, without comparing names. A frame made for a call that was not resolved
+ * also has the names of its slots, so its variables can still be found by name.
+ */
+class FrameEnv: public Env {
+public:
+    std::vector<PTR(Val)> slots;
+    var_list_t names;
+    PTR(Env) rest;
+
+    FrameEnv(PTR(Env) env, int size);
+    FrameEnv(PTR(Env) env, var_list_t names, std::vector<PTR(Val)> slots);
+    ~FrameEnv();
+
+    PTR(Val) lookup(const Symbol &find_name);
+    PTR(Val) lookup(int depth, int slot);
+    void bind(int slot, PTR(Val) val);
+};
@@ -0,0 +1,194 @@
+//
+// Hash-consed construction of Expr nodes.
+//
+
+#include <algorithm>
+#include <atomic>
+#include "expr_factory.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+typedef enum {
+    num_kind,
+    var_kind,
+    add_kind,
+    mult_kind,
+    let_kind,
+    bool_kind,
+    if_kind,
+    equal_kind,
+    fun_kind,
+    call_kind
+} kind_t;
+
+ExprFactory::ExprFactory() {
+    // Ids are never reused, so nodes that outlive their factory can
+    // never be mistaken for nodes of a later one.
+    static std::atomic<unsigned long> next_id(1);
+    this->id = next_id++;
+    this->sweep_at = min_sweep;
+}
+
+size_t ExprFactory::size() {
+    return nodes.size();
+}
+
+// Drops the nodes held only by the table, newest first, so that by the
+// time a node is reached every parent it had in the table is gone.
+void ExprFactory::sweep() {
+    for (size_t i = order.size(); i > 0; i--) {
+        if (order[i - 1]->second.use_count() == 1) {
+            nodes.erase(order[i - 1]->first);
+            order[i - 1] = nullptr;
+        }
+    }
+    order.erase(std::remove(order.begin(), order.end(), nullptr), order.end());
+    sweep_at = std::max(min_sweep, 2 * nodes.size());
+}
+
+size_t ExprFactory::key_hash::operator()(const key_t &k) const {
+    size_t h = std::hash<int64_t>()(k.n) ^ (size_t) k.kind;
+    h = h * 31 + std::hash<const void *>()(k.a);
+    h = h * 31 + std::hash<const void *>()(k.b);
+    h = h * 31 + std::hash<const void *>()(k.c);
+    for (const void *p : k.more)
+        h = h * 31 + std::hash<const void *>()(p);
+    if (!k.digits.empty())
+        h = h * 31 + std::hash<std::string>()(k.digits);
+    return h;
+}
+
+ExprFactory::key_t ExprFactory::key(NumExpr *, int64_t rep) {
+    return {num_kind, nullptr, nullptr, nullptr, rep};
+}
+
+ExprFactory::key_t ExprFactory::key(NumExpr *, const BigInt &rep) {
+    key_t k = {num_kind, nullptr, nullptr, nullptr, 0};
+    k.digits = rep.to_string();
+    return k;
+}
+
+ExprFactory::key_t ExprFactory::key(VarExpr *, const Symbol &name) {
+    return {var_kind, &name.str(), nullptr, nullptr, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(AddExpr *, const PTR(Expr) &lhs, const PTR(Expr) &rhs) {
+    return {add_kind, &*lhs, &*rhs, nullptr, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(MultExpr *, const PTR(Expr) &lhs, const PTR(Expr) &rhs) {
+    return {mult_kind, &*lhs, &*rhs, nullptr, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(LetExpr *, const Symbol &name, const PTR(Expr) &var_val, const PTR(Expr) &in_expr) {
+    return {let_kind, &name.str(), &*var_val, &*in_expr, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(BoolExpr *, bool rep) {
+    return {bool_kind, nullptr, nullptr, nullptr, rep};
+}
+
+ExprFactory::key_t ExprFactory::key(IfExpr *, const PTR(Expr) &test_part, const PTR(Expr) &then_part,
+                                    const PTR(Expr) &else_part) {
+    return {if_kind, &*test_part, &*then_part, &*else_part, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(EqualExpr *, const PTR(Expr) &lhs, const PTR(Expr) &rhs) {
+    return {equal_kind, &*lhs, &*rhs, nullptr, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(FunExpr *, const Symbol &formal_arg, const PTR(Expr) &actual_arg) {
+    return {fun_kind, &formal_arg.str(), &*actual_arg, nullptr, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(FunExpr *, const var_list_t &formal_args, const PTR(Expr) &actual_arg) {
+    key_t k = {fun_kind, &(*formal_args)[0].str(), &*actual_arg, nullptr, 0};
+    for (size_t i = 1; i < formal_args->size(); i++)
+        k.more.push_back(&(*formal_args)[i].str());
+    return k;
+}
+
+ExprFactory::key_t ExprFactory::key(FunExpr *, const Symbol &self_name, const var_list_t &formal_args,
+                                    const PTR(Expr) &actual_arg) {
+    key_t k = key((FunExpr *) nullptr, formal_args, actual_arg);
+    if (!self_name.str().empty())
+        k.c = &self_name.str();
+    return k;
+}
+
+ExprFactory::key_t ExprFactory::key(CallExpr *, const PTR(Expr) &to_be_called, const PTR(Expr) &actual_argument) {
+    return {call_kind, &*to_be_called, &*actual_argument, nullptr, 0};
+}
+
+ExprFactory::key_t ExprFactory::key(CallExpr *, const PTR(Expr) &to_be_called,
+                                    const std::vector<PTR(Expr)> &actual_args) {
+    key_t k = {call_kind, &*to_be_called, &*actual_args[0], nullptr, 0};
+    for (size_t i = 1; i < actual_args.size(); i++)
+        k.more.push_back(&*actual_args[i]);
+    return k;
+}
+
+TEST_CASE("hash consing") {
+    ExprFactory factory;
+
+    PTR(Expr) x = factory.make<VarExpr>("x");
+    PTR(Expr) one = factory.make<NumExpr>(1);
+    CHECK(factory.make<VarExpr>("x") == x);
+    CHECK(factory.make<NumExpr>(1) == one);
+    CHECK(factory.make<NumExpr>(2) != one);
+    CHECK(factory.make<BoolExpr>(true) != factory.make<NumExpr>(1));
+    CHECK(factory.make<AddExpr>(x, one) == factory.make<AddExpr>(x, one));
+    CHECK(factory.make<AddExpr>(x, one) != factory.make<AddExpr>(one, x));
+    CHECK(factory.make<AddExpr>(x, one) != factory.make<MultExpr>(x, one));
+    CHECK(factory.make<FunExpr>("x", x) != factory.make<FunExpr>("y", x));
+    CHECK(factory.size() == 9);
+    CHECK(factory.make<NumExpr>(BigInt::parse("99999999999999999999", false))
+          == factory.make<NumExpr>(BigInt::parse("99999999999999999999", false)));
+    CHECK(factory.make<NumExpr>(BigInt::parse("99999999999999999999", true))
+          != factory.make<NumExpr>(BigInt::parse("99999999999999999999", false)));
+    CHECK(factory.size() == 11);
+
+    // Nodes from a factory still compare structurally with other nodes.
+    CHECK(factory.make<AddExpr>(x, one)->equals(NEW(AddExpr)(NEW(VarExpr)("x"), NEW(NumExpr)(1))));
+    CHECK(NEW(AddExpr)(NEW(VarExpr)("x"), NEW(NumExpr)(1))->equals(factory.make<AddExpr>(x, one)));
+    CHECK(!factory.make<AddExpr>(x, one)->equals(factory.make<AddExpr>(one, x)));
+
+    std::string program = "_let f = _fun (x) x * x + 1 _in f(f(2) + f(2)) + f(f(2) + f(2))";
+    PTR(Expr) shared = parse(program, factory);
+    PTR(Expr) plain = parse_str(program);
+    CHECK(shared->equals(plain));
+    CHECK(plain->equals(shared));
+    CHECK(shared->interp(Env::empty)->equals(plain->interp(Env::empty)));
+    CHECK(shared->optimize()->equals(plain->optimize()));
+    CHECK(parse(program, factory) == shared);
+
+    PTR(AddExpr) body = CAST(AddExpr)(CAST(LetExpr)(shared)->in_expr);
+    CHECK(body->lhs == body->rhs);
+    PTR(AddExpr) arg = CAST(AddExpr)(CAST(CallExpr)(body->lhs)->actual_args[0]);
+    CHECK(arg->lhs == arg->rhs);
+
+    PTR(Expr) calls = parse("(_fun (a, b) a)(1, 2) + (_fun (a, b) a)(1, 2) + (_fun (a, b) a)(2, 1)", factory);
+    PTR(AddExpr) first_sum = CAST(AddExpr)(calls);
+    PTR(AddExpr) second_sum = CAST(AddExpr)(first_sum->rhs);
+    CHECK(first_sum->lhs == second_sum->lhs);
+    CHECK(first_sum->lhs != second_sum->rhs);
+    CHECK(CAST(CallExpr)(first_sum->lhs)->to_be_called == CAST(CallExpr)(second_sum->rhs)->to_be_called);
+    CHECK(calls->equals(parse_str("(_fun (a, b) a)(1, 2) + (_fun (a, b) a)(1, 2) + (_fun (a, b) a)(2, 1)")));
+
+    // Optimizing must not change a node that other trees share.
+    PTR(Expr) let = parse("_let y = 1 + 2 _in y * z", factory);
+    PTR(Expr) also_let = parse("(_let y = 1 + 2 _in y * z) + 1", factory);
+    CHECK(let->optimize()->equals(parse_str("3 * z")));
+    CHECK(CAST(LetExpr)(let)->var_val->equals(parse_str("1 + 2")));
+    CHECK(CAST(AddExpr)(also_let)->lhs == let);
+
+    // Nodes no program holds any more are swept, so the table stays
+    // bounded however many different programs are parsed.
+    ExprFactory bounded;
+    PTR(Expr) kept = parse("_let x = 1 _in x + 7", bounded);
+    for (int i = 0; i < 20000; i++)
+        parse("_let x = " + std::to_string(i) + " _in x + " + std::to_string(i * 7), bounded);
+    CHECK(bounded.size() < 10000);
+    CHECK(parse("_let x = 1 _in x + 7", bounded) == kept);
+    CHECK(kept->interp(Env::empty)->equals(NEW(NumVal)(8)));
+}
@@ -0,0 +1,106 @@
+//
+// Hash-consed construction of Expr nodes.
+//
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "pointer.hpp"
+#include "Expr.hpp"
+
+/**
+ * An <code>ExprFactory</code> makes each distinct Expr only once. Asking it for a node whose kind, fields and
+ * children match one it already made returns that node, so repeated subtrees are shared. Since children are made
+ * by the factory too, structurally equal nodes from one factory are always the same node, and
+ * <code>equals</code> between them is a pointer compare.
+ * Nodes only the factory still holds are swept once the table has doubled since the last sweep, so a factory used
+ * for many programs holds about as many nodes as the live programs share, instead of every node it ever made.
+ */
+class ExprFactory {
+public:
+    ExprFactory();
+
+    ExprFactory(const ExprFactory &) = delete;
+    ExprFactory &operator=(const ExprFactory &) = delete;
+
+    /**
+     * Returns the node <code>NEW(T)(args...)</code> would make, reusing an equal one if there is one.
+     * The children passed in must have been made by this factory.
+     * @param args arguments for the constructor of T.
+     * @return shared node.
+     */
+    template <typename T, typename... Args>
+    PTR(Expr) make(Args... args) {
+        key_t k = key((T *) nullptr, args...);
+        auto found = nodes.find(k);
+        if (found != nodes.end())
+            return found->second;
+
+        if (nodes.size() >= sweep_at)
+            sweep();
+        PTR(Expr) e = NEW(T)(args...);
+        e->consed_by = id;
+        order.push_back(&*nodes.emplace(k, e).first);
+        return e;
+    }
+
+    /**
+     * Returns the number of distinct nodes made so far.
+     * @return number of nodes.
+     */
+    size_t size();
+
+private:
+    // Children are identified by address, since equal children are
+    // already the same node. Names are identified by their Symbol.
+    // Functions and calls with more than one argument list the rest
+    // in more. Numbers too large for n are identified by their digits.
+    typedef struct key_t {
+        int kind;
+        const void *a;
+        const void *b;
+        const void *c;
+        int64_t n;
+        std::vector<const void *> more;
+        std::string digits;
+
+        bool operator==(const key_t &other) const {
+            return kind == other.kind && a == other.a && b == other.b && c == other.c && n == other.n
+                   && more == other.more && digits == other.digits;
+        }
+    } key_t;
+
+    struct key_hash {
+        size_t operator()(const key_t &k) const;
+    };
+
+    // Fewest nodes worth sweeping for.
+    static constexpr size_t min_sweep = 4096;
+
+    unsigned long id;
+    std::unordered_map<key_t, PTR(Expr), key_hash> nodes;
+    // Entries of the table in the order their nodes were made, so a
+    // sweep meets every node before its children.
+    std::vector<std::pair<const key_t, PTR(Expr)> *> order;
+    // Size of the table that triggers the next sweep.
+    size_t sweep_at;
+
+    void sweep();
+
+    static key_t key(NumExpr *, int64_t rep);
+    static key_t key(NumExpr *, const BigInt &rep);
+    static key_t key(VarExpr *, const Symbol &name);
+    static key_t key(AddExpr *, const PTR(Expr) &lhs, const PTR(Expr) &rhs);
+    static key_t key(MultExpr *, const PTR(Expr) &lhs, const PTR(Expr) &rhs);
+    static key_t key(LetExpr *, const Symbol &name, const PTR(Expr) &var_val, const PTR(Expr) &in_expr);
+    static key_t key(BoolExpr *, bool rep);
+    static key_t key(IfExpr *, const PTR(Expr) &test_part, const PTR(Expr) &then_part, const PTR(Expr) &else_part);
+    static key_t key(EqualExpr *, const PTR(Expr) &lhs, const PTR(Expr) &rhs);
+    static key_t key(FunExpr *, const Symbol &formal_arg, const PTR(Expr) &actual_arg);
+    static key_t key(FunExpr *, const var_list_t &formal_args, const PTR(Expr) &actual_arg);
+    static key_t key(FunExpr *, const Symbol &self_name, const var_list_t &formal_args, const PTR(Expr) &actual_arg);
+    static key_t key(CallExpr *, const PTR(Expr) &to_be_called, const PTR(Expr) &actual_argument);
+    static key_t key(CallExpr *, const PTR(Expr) &to_be_called, const std::vector<PTR(Expr)> &actual_args);
+};
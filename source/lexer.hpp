@@ -0,0 +1,71 @@
+//
+// Scans MSDscript source held in one contiguous buffer.
+//
+
+#pragma once
+
+#include <cctype>
+#include <cstdio>
+#include <string_view>
+
+/**
+ * A <code>Lexer</code> reads characters and tokens from source text that is already in memory, such as a mapped
+ * file. Its reads are inline and never copy, and names and numbers are returned as spans of the source text.
+ * Like an istream, it reports EOF once the text runs out.
+ */
+class Lexer {
+public:
+    std::string_view text;
+    size_t pos;
+
+    /**
+     * Constructs a Lexer positioned at the start of some text. The text must outlive the Lexer.
+     * @param text source text to scan.
+     */
+    Lexer(std::string_view text) : text(text), pos(0) { }
+
+    /**
+     * Returns the next character without consuming it.
+     * @return next character, or EOF at the end of the text.
+     */
+    int peek() {
+        return (pos < text.size()) ? (unsigned char) text[pos] : EOF;
+    }
+
+    /**
+     * Consumes and returns the next character.
+     * @return next character, or EOF at the end of the text.
+     */
+    int get() {
+        return (pos < text.size()) ? (unsigned char) text[pos++] : EOF;
+    }
+
+    /**
+     * Returns true once every character has been consumed.
+     */
+    bool eof() {
+        return pos >= text.size();
+    }
+
+    /**
+     * Consumes a run of letters.
+     * @return the letters, which may be empty.
+     */
+    std::string_view scan_alphabetic() {
+        size_t start = pos;
+        while (pos < text.size() && isalpha((unsigned char) text[pos]))
+            pos++;
+        return text.substr(start, pos - start);
+    }
+
+    /**
+     * Consumes a run of digits.
+     * @return the digits, which may be empty.
+     */
+    std::string_view scan_digits() {
+        size_t start = pos;
+        while (pos < text.size() && isdigit((unsigned char) text[pos]))
+            pos++;
+        return text.substr(start, pos - start);
+    }
+};
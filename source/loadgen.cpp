@@ -0,0 +1,114 @@
+//
+// Load generator for MSDscript --serve, built as msdscript_loadgen.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "server.hpp"
+
+static const char *default_program =
+        "_letrec fib = _fun (x) _if x == 0 _then 1 _else _if x == 1 _then 1 _else fib(x + -1) + fib(x + -2)"
+        "_in fib(15)";
+
+// Runs one program the way callers did before --serve: a new process
+// per program, fed through stdin.
+static std::string run_process(const char *msdscript, const std::string &program) {
+    int to_child[2], from_child[2];
+    if (pipe(to_child) < 0 || pipe(from_child) < 0)
+        throw std::runtime_error("cannot create pipe");
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(to_child[0], 0);
+        dup2(from_child[1], 1);
+        close(to_child[1]);
+        close(from_child[0]);
+        execl(msdscript, msdscript, (char *) nullptr);
+        _exit(127);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+    (void) write(to_child[1], program.data(), program.size());
+    close(to_child[1]);
+
+    std::string output;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(from_child[0], buffer, sizeof(buffer))) > 0)
+        output.append(buffer, n);
+    close(from_child[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return output;
+}
+
+// Usage: msdscript_loadgen <socket> | --exec=<msdscript> [connections] [requests] [program]
+// Each connection sends its requests one after another, waiting for
+// each response, and every request's latency is recorded.
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <socket> | --exec=<msdscript> [connections] [requests] [program]\n", argv[0]);
+        return 1;
+    }
+    const char *target = argv[1];
+    const char *exec_path = !strncmp(target, "--exec=", 7) ? target + 7 : nullptr;
+    int connections = (argc > 2) ? atoi(argv[2]) : 4;
+    int requests = (argc > 3) ? atoi(argv[3]) : 1000;
+    std::string program = (argc > 4) ? argv[4] : default_program;
+
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<int> failures(connections, 0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < connections; i++) {
+        threads.push_back(std::thread([&, i]() {
+            try {
+                std::unique_ptr<Client> client;
+                if (exec_path == nullptr)
+                    client.reset(new Client(target));
+                for (int j = 0; j < requests; j++) {
+                    auto sent = std::chrono::steady_clock::now();
+                    bool failed = false;
+                    if (client != nullptr)
+                        client->run(program, failed);
+                    else
+                        run_process(exec_path, program);
+                    std::chrono::duration<double, std::micro> latency = std::chrono::steady_clock::now() - sent;
+                    latencies[i].push_back(latency.count());
+                    failures[i] += failed;
+                }
+            } catch (const std::runtime_error &error) {
+                fprintf(stderr, "connection %d: %s\n", i, error.what());
+            }
+        }));
+    }
+    for (std::thread &t : threads)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> all;
+    int failed = 0;
+    for (int i = 0; i < connections; i++) {
+        all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+        failed += failures[i];
+    }
+    if (all.empty())
+        return 1;
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all[std::min(all.size() - 1, (size_t) (p * all.size()))]; };
+
+    printf("%-12s %10s %10s %10s %10s %10s %12s\n", "requests", "errors", "p50 us", "p90 us", "p99 us", "max us",
+           "req/s");
+    printf("%-12zu %10d %10.0f %10.0f %10.0f %10.0f %12.0f\n", all.size(), failed, percentile(0.5),
+           percentile(0.9), percentile(0.99), all.back(), all.size() / elapsed.count());
+    return 0;
+}
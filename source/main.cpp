@@ -1,47 +1,115 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <thread>
 #include "parser.hpp"
 
 #define CATCH_CONFIG_RUNNER
 
 #include "catch.hpp"
 #include "pointer.hpp"
+#include "driver.hpp"
+#include "arena.hpp"
+#include "mapped_file.hpp"
+#include "expr_factory.hpp"
+#include "server.hpp"
 #include "Step.hpp"
+#include "parallel.hpp"
+#include "memo.hpp"
 
 int main(int argc, char **argv) {
     try {
         PTR(Expr) e;
-        bool optimize_mode = false;
-        bool step_mode = false;
+        run_mode_t mode = interp_mode;
+        bool batch_mode = false;
+        char batch_delim = '\n';
+        bool share_nodes = false;
+        const char *serve_path = nullptr;
+        int workers = (int) std::thread::hardware_concurrency();
+        ExprFactory factory;
 
-        if ((argc > 1) && !strcmp(argv[1], "--opt")) {
-            optimize_mode = true;
+        // Flags come before the optional file name, in any order.
+        while ((argc > 1) && !strncmp(argv[1], "--", 2)) {
+            if (!strcmp(argv[1], "--opt")) {
+                mode = optimize_mode;
+            } else if (!strcmp(argv[1], "--step")) {
+                mode = step_mode;
+            } else if (!strcmp(argv[1], "--vm")) {
+                mode = vm_mode;
+            } else if (!strcmp(argv[1], "--compiled")) {
+                mode = compiled_mode;
+            } else if (!strcmp(argv[1], "--parallel")) {
+                mode = parallel_mode;
+            } else if (!strcmp(argv[1], "--batch")) {
+                batch_mode = true;
+            } else if (!strncmp(argv[1], "--batch=", 8) && strlen(argv[1]) == 9) {
+                batch_mode = true;
+                batch_delim = argv[1][8];
+            } else if (!strcmp(argv[1], "--share")) {
+                share_nodes = true;
+            } else if (!strncmp(argv[1], "--serve=", 8) && strlen(argv[1]) > 8) {
+                serve_path = argv[1] + 8;
+            } else if (!strncmp(argv[1], "--workers=", 10) && atoi(argv[1] + 10) > 0) {
+                workers = atoi(argv[1] + 10);
+                ForkJoin::shared_threads = workers;
+            } else if (!strncmp(argv[1], "--max-steps=", 12) && atol(argv[1] + 12) > 0) {
+                Step::max_steps = atol(argv[1] + 12);
+            } else if (!strncmp(argv[1], "--timeout=", 10) && atol(argv[1] + 10) > 0) {
+                Step::time_limit = std::chrono::milliseconds(atol(argv[1] + 10));
+            } else if (!strcmp(argv[1], "--memo")) {
+                MemoCache::capacity = 65536;
+            } else if (!strncmp(argv[1], "--memo=", 7) && atol(argv[1] + 7) > 0) {
+                MemoCache::capacity = atol(argv[1] + 7);
+            } else if (!strcmp(argv[1], "--bignum")) {
+                NumVal::promote_on_overflow = true;
+            } else if (!strcmp(argv[1], "--test")) {
+                std::cout << Catch::Session().run();
+                return 0;
+            } else {
+                throw std::runtime_error((std::string)"unknown flag " + argv[1]);
+            }
             argc--;
             argv++;
-        } else if ((argc > 1) && !strcmp(argv[1], "--step")) {
-            step_mode = true;
-            argc--;
-            argv++;
-        } else if ((argc > 1) && !strcmp(argv[1], "--test")) {
-            std::cout << Catch::Session().run();
+        }
+
+        if (serve_path != nullptr) {
+            if (Step::max_steps == 0)
+                Step::max_steps = Server::default_max_steps;
+            Server server(serve_path, mode, workers);
+            server.run();
             return 0;
-    }
+        }
+
+        if (batch_mode) {
+            bool all_ok;
+            if (argc > 1) {
+                MappedFile prog_file(argv[1]);
+                all_ok = run_batch(prog_file.text(), std::cout, mode, batch_delim, share_nodes ? &factory : nullptr);
+            } else {
+                all_ok = run_batch(std::cin, std::cout, mode, batch_delim, share_nodes ? &factory : nullptr);
+            }
+            return all_ok ? 0 : 1;
+        }
 
-    if (argc > 1) {
-            std::ifstream prog_in(argv[1]);
-            e = parse(prog_in);
+        if (argc > 1) {
+            MappedFile prog_file(argv[1]);
+            e = share_nodes ? parse(prog_file.text(), factory) : parse(prog_file.text(), NEW(Arena)());
+        } else if (share_nodes) {
+            std::string text((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+            e = parse(text, factory);
         } else {
-            e = parse(std::cin);
+            e = parse(std::cin, NEW(Arena)());
         }
 
-        if (optimize_mode)
-            std::cout << e->optimize()->expr_print() << "\n";
-        else if (step_mode)
-            std::cout << Step::interp_by_steps(e)->to_string();
-        else
-            std::cout << e->interp(Env::empty)->to_string() << "\n";
+        // Step mode has always printed its result without a newline.
+        std::cout << run_program(e, mode);
+        if (mode != step_mode)
+            std::cout << "\n";
         return 0;
     } catch (std::runtime_error error) {
         std::cerr << error.what() << "\n";
         return 1;
     }
-}
\ No newline at end of file
+}
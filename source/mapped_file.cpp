@@ -0,0 +1,71 @@
+//
+// Read-only memory mapping of a source file.
+//
+
+#include <cstdio>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.hpp"
+#include "catch.hpp"
+
+MappedFile::MappedFile(const std::string &path) {
+    this->data = nullptr;
+    this->size = 0;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("cannot open " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("cannot open " + path);
+    }
+
+    // mmap rejects a length of 0, and an empty file needs no mapping.
+    if (st.st_size > 0) {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("cannot map " + path);
+        }
+        this->data = (const char *) p;
+        this->size = st.st_size;
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr)
+        munmap((void *) data, size);
+}
+
+std::string_view MappedFile::text() {
+    return std::string_view(data, size);
+}
+
+TEST_CASE("mapped file") {
+    char path[] = "/tmp/msdscript_mapped_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    {
+        MappedFile empty(path);
+        CHECK(empty.text().empty());
+    }
+
+    FILE *f = fopen(path, "w");
+    fputs("_let x = 5 _in x + 1\n", f);
+    fclose(f);
+    {
+        MappedFile file(path);
+        CHECK(file.text() == "_let x = 5 _in x + 1\n");
+    }
+
+    unlink(path);
+    CHECK_THROWS_WITH(MappedFile(path), std::string("cannot open ") + path);
+}
@@ -0,0 +1,36 @@
+//
+// Read-only memory mapping of a source file.
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/**
+ * A <code>MappedFile</code> maps a whole file into memory for reading, so it can be parsed in place without
+ * copying it through a stream. The mapping is released when the MappedFile is destroyed.
+ */
+class MappedFile {
+public:
+    /**
+     * Maps a file.
+     * /exception If the file cannot be opened or mapped, an error will be thrown.
+     * @param path path of the file to map.
+     */
+    MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /**
+     * Returns the contents of the file, valid until the MappedFile is destroyed.
+     * @return view of the whole file.
+     */
+    std::string_view text();
+
+private:
+    const char *data;
+    size_t size;
+};
@@ -0,0 +1,135 @@
+//
+// Least-recently-used cache of function call results.
+//
+
+#include <functional>
+#include "memo.hpp"
+#include "driver.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+size_t MemoCache::capacity = 0;
+
+MemoCache &MemoCache::local() {
+    static thread_local MemoCache memo;
+    return memo;
+}
+
+MemoCache::key_t MemoCache::make_key(const PTR(Val) &fun, const PTR(Val) &arg) {
+    key_t key;
+    key.fun = &*fun;
+    key.is_bool = (arg->tag == Val::bool_tag);
+    key.arg = key.is_bool ? arg->is_true() : static_cast<NumVal *>(&*arg)->rep;
+    return key;
+}
+
+size_t MemoCache::key_hash::operator()(const key_t &k) const {
+    return std::hash<const void *>()(k.fun) ^ (std::hash<int64_t>()(k.arg) * 31 + k.is_bool);
+}
+
+bool MemoCache::key_equal::operator()(const key_t &a, const key_t &b) const {
+    return a.fun == b.fun && a.arg == b.arg && a.is_bool == b.is_bool;
+}
+
+PTR(Val) MemoCache::find(const PTR(Val) &fun, const PTR(Val) &arg) {
+    auto found = index.find(make_key(fun, arg));
+    if (found == index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->result;
+}
+
+void MemoCache::store(const PTR(Val) &fun, const PTR(Val) &arg, const PTR(Val) &result) {
+    if (capacity == 0)
+        return;
+    key_t key = make_key(fun, arg);
+    auto found = index.find(key);
+    if (found != index.end()) {
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+    while (index.size() >= capacity) {
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+    entries.push_front({key, fun, result});
+    index[key] = entries.begin();
+}
+
+void MemoCache::defer(const PTR(Val) &fun, const PTR(Val) &arg) {
+    // More deferred calls than the cache holds could not all be kept.
+    if (deferred.size() < capacity)
+        deferred.push_back(std::make_pair(fun, arg));
+}
+
+void MemoCache::store_deferred(size_t mark, const PTR(Val) &result) {
+    for (size_t i = mark; i < deferred.size(); i++)
+        store(deferred[i].first, deferred[i].second, result);
+    deferred.resize(mark);
+}
+
+// Drops the calls deferred by a chain that failed.
+void MemoCache::drop_deferred(size_t mark) {
+    if (deferred.size() > mark)
+        deferred.resize(mark);
+}
+
+void MemoCache::clear() {
+    index.clear();
+    entries.clear();
+    hits = 0;
+    misses = 0;
+}
+
+TEST_CASE("memo cache") {
+    MemoCache::capacity = 2;
+    MemoCache memo;
+    PTR(Val) f = NEW(FunVal)("x", parse_str("x"), Env::empty);
+    PTR(Val) g = NEW(FunVal)("x", parse_str("x"), Env::empty);
+    memo.store(f, NumVal::make(1), NumVal::make(10));
+    memo.store(g, NumVal::make(1), NumVal::make(20));
+    CHECK(memo.find(f, NumVal::make(1))->equals(NumVal::make(10)));
+    CHECK(memo.find(g, NEW(NumVal)(1))->equals(NumVal::make(20)));
+    CHECK(memo.find(f, BoolVal::make(true)) == nullptr);
+
+    // f's entry was used less recently than g's, so it goes first.
+    memo.store(f, BoolVal::make(true), NumVal::make(30));
+    CHECK(memo.size() == 2);
+    CHECK(memo.find(f, NumVal::make(1)) == nullptr);
+    CHECK(memo.find(g, NumVal::make(1)) != nullptr);
+    CHECK(memo.find(f, BoolVal::make(true))->equals(NumVal::make(30)));
+    CHECK(memo.hits == 4);
+    CHECK(memo.misses == 2);
+
+    // fib is exponential without the cache and linear with it, in each mode.
+    MemoCache::capacity = 1000;
+    MemoCache::local().clear();
+    std::string fib = "_letrec fib = _fun (x) _if x == 0 _then 1 _else _if x == 1 _then 1"
+                      "  _else fib(x + -1) + fib(x + -2) _in fib(60)";
+    CHECK(run_program(parse_str(fib), interp_mode) == "2504730781961");
+    CHECK(MemoCache::local().misses == 61);
+    MemoCache::local().clear();
+    CHECK(run_program(parse_str(fib), step_mode) == "2504730781961");
+    CHECK(MemoCache::local().misses == 61);
+
+    // Results of tail calls are cached, and a long loop of them still
+    // does not grow the stack.
+    MemoCache::local().clear();
+    std::string count = "_letrec count = _fun (n) _if n == 0 _then 42 _else count(n + -1) _in count(";
+    CHECK(run_program(parse_str(count + "100000)"), interp_mode) == "42");
+    CHECK(run_program(parse_str(count + "100000)"), step_mode) == "42");
+    CHECK(MemoCache::local().size() == 1000);
+
+    // Errors are not cached.
+    MemoCache::local().clear();
+    std::string fails = "_let f = _fun (x) _if x == 0 _then _true + 1 _else x _in f(1) + f(1) + f(0)";
+    CHECK_THROWS_WITH(run_program(parse_str(fails), interp_mode), "no adding booleans");
+    CHECK(MemoCache::local().size() == 1);
+    CHECK_THROWS_WITH(run_program(parse_str(fails), step_mode), "no adding booleans");
+    CHECK(MemoCache::local().size() == 2);
+    MemoCache::capacity = 0;
+    MemoCache::local().clear();
+}
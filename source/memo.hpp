@@ -0,0 +1,135 @@
+//
+// Least-recently-used cache of function call results.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "pointer.hpp"
+#include "value.hpp"
+
+/**
+ * A <code>MemoCache</code> remembers the results of calling functions with a number or boolean argument. Programs
+ * have no side effects, so calling the same FunVal with an equal argument always gives the same result.
+ * Each thread has its own cache, which holds at most <code>capacity</code> results and forgets the least recently
+ * used one first. Cached results keep their FunVal alive, so a FunVal's address is never reused while it is cached.
+ * Every call in a chain of tail calls returns the chain's result, so the calls are deferred and stored together
+ * once it arrives, and tail calls still do not grow the stack.
+ */
+class MemoCache {
+public:
+    /* Set once at startup to the number of results each thread's cache holds, or 0 to not cache results. */
+    static size_t capacity;
+
+    /**
+     * Records the calls deferred while one chain of tail calls is evaluated, and stores them once its result is
+     * known. Calls deferred by a chain that fails are dropped.
+     */
+    class chain_t {
+    public:
+        chain_t() {
+            mark = (capacity > 0) ? local().deferred.size() : SIZE_MAX;
+        }
+
+        ~chain_t() {
+            if (mark != SIZE_MAX)
+                local().drop_deferred(mark);
+        }
+
+        /**
+         * Stores the chain's deferred calls with their result.
+         * @param result result of the chain.
+         */
+        void finish(const PTR(Val) &result) {
+            if (mark != SIZE_MAX)
+                local().store_deferred(mark, result);
+        }
+
+    private:
+        // Number of calls deferred before the chain started, or SIZE_MAX if caching is off.
+        size_t mark;
+    };
+
+    /**
+     * @return the calling thread's cache.
+     */
+    static MemoCache &local();
+
+    /**
+     * @param fun Val being called.
+     * @param arg argument it is called with.
+     * @return true if caching is on and the call's result can be cached.
+     */
+    static bool memoizable(const PTR(Val) &fun, const PTR(Val) &arg) {
+        return capacity > 0 && fun->tag == Val::fun_tag && (arg->tag == Val::num_tag || arg->tag == Val::bool_tag);
+    }
+
+    /**
+     * Finds a cached result, and marks it as the most recently used.
+     * @param fun FunVal that was called.
+     * @param arg argument it was called with.
+     * @return cached result, or nullptr if there is none.
+     */
+    PTR(Val) find(const PTR(Val) &fun, const PTR(Val) &arg);
+
+    /**
+     * Caches a result, forgetting the least recently used one if the cache is full.
+     * @param fun FunVal that was called.
+     * @param arg argument it was called with.
+     * @param result result of the call.
+     */
+    void store(const PTR(Val) &fun, const PTR(Val) &arg, const PTR(Val) &result);
+
+    /**
+     * Defers a call until the chain of tail calls it is part of has a result.
+     * @param fun FunVal being called.
+     * @param arg argument it is called with.
+     */
+    void defer(const PTR(Val) &fun, const PTR(Val) &arg);
+
+    /**
+     * Forgets every cached result.
+     */
+    void clear();
+
+    size_t size() const {
+        return index.size();
+    }
+
+    long hits = 0;
+    long misses = 0;
+
+private:
+    typedef struct {
+        const Val *fun;
+        int64_t arg;
+        bool is_bool;
+    } key_t;
+
+    struct key_hash {
+        size_t operator()(const key_t &k) const;
+    };
+
+    struct key_equal {
+        bool operator()(const key_t &a, const key_t &b) const;
+    };
+
+    typedef struct {
+        key_t key;
+        PTR(Val) fun;
+        PTR(Val) result;
+    } entry_t;
+
+    // Most recently used first.
+    std::list<entry_t> entries;
+    std::unordered_map<key_t, std::list<entry_t>::iterator, key_hash, key_equal> index;
+    // Calls deferred by the chains being evaluated, innermost last.
+    std::vector<std::pair<PTR(Val), PTR(Val)>> deferred;
+
+    static key_t make_key(const PTR(Val) &fun, const PTR(Val) &arg);
+    void store_deferred(size_t mark, const PTR(Val) &result);
+    void drop_deferred(size_t mark);
+};
@@ -0,0 +1,231 @@
+//
+// Fork-join evaluation of independent subexpressions on a work-stealing thread pool.
+//
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "parallel.hpp"
+#include "scope.hpp"
+#include "env.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+int ForkJoin::shared_threads = (int) std::thread::hardware_concurrency();
+
+ForkJoin::task_t::task_t(PTR(Expr) expr, PTR(Env) env, bool root, task_t *parent) : done(false), cancelled(false) {
+    this->expr = expr;
+    this->env = env;
+    this->val = nullptr;
+    this->root = root;
+    this->parent = parent;
+}
+
+bool ForkJoin::task_t::is_cancelled() const {
+    for (const task_t *t = this; t != nullptr; t = t->parent) {
+        if (t->cancelled.load(std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+ForkJoin::ForkJoin(int threads) : next_deque(0), queued(0), idle(0), sleeping(0), forked(0), stopping(false) {
+    threads = values_are_thread_safe ? std::max(threads, 1) : 1;
+    for (int i = 0; i < threads; i++)
+        deques.push_back(std::make_unique<deque_t>());
+    for (int i = 0; i < threads; i++)
+        this->threads.push_back(std::thread([this, i]() { work(i); }));
+}
+
+ForkJoin::~ForkJoin() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_cond.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+}
+
+ForkJoin &ForkJoin::shared() {
+    static ForkJoin pool(shared_threads);
+    return pool;
+}
+
+PTR(Val) ForkJoin::run(PTR(Expr) e) {
+    Scope scope(nullptr);
+    PTR(Expr) resolved = e->resolve(scope);
+    task_t task(resolved, NEW(FrameEnv)(Env::empty, scope.frame_size), true, nullptr);
+    push(next_deque++ % deques.size(), &task);
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        done_cond.wait(guard, [&task]() { return task.done.load(); });
+    }
+    if (task.error)
+        std::rethrow_exception(task.error);
+    return task.val;
+}
+
+void ForkJoin::work(size_t i) {
+    active = this;
+    index = i;
+    idle++;
+    while (1) {
+        task_t *task = steal(i);
+        if (task != nullptr) {
+            idle--;
+            execute(*task);
+            idle++;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        sleeping++;
+        work_cond.wait(guard, [this]() { return stopping || queued > 0; });
+        sleeping--;
+        if (stopping)
+            return;
+    }
+}
+
+// Hands rhs to the deque for an idle thread to steal, and evaluates lhs
+// meanwhile. The left operand's error wins, as it does with interp.
+void ForkJoin::interp_forked(const PTR(Expr) &lhs, const PTR(Expr) &rhs, const PTR(Env) &env,
+                             PTR(Val) &lhs_val, PTR(Val) &rhs_val) {
+    task_t task(rhs, env, false, current);
+    push(index, &task);
+    forked++;
+
+    std::exception_ptr lhs_error = nullptr;
+    try {
+        lhs_val = lhs->interp(env);
+    } catch (const std::runtime_error &) {
+        lhs_error = std::current_exception();
+        task.cancelled = true;
+    }
+    join(task);
+    if (lhs_error)
+        std::rethrow_exception(lhs_error);
+    if (task.error)
+        std::rethrow_exception(task.error);
+    rhs_val = task.val;
+}
+
+// Waits for a forked task, evaluating it here if no thread has stolen
+// it, unless it was cancelled, and otherwise running other tasks until
+// the thief finishes.
+void ForkJoin::join(task_t &task) {
+    {
+        deque_t &own = *deques[index];
+        std::unique_lock<std::mutex> guard(own.lock);
+        if (!own.tasks.empty() && own.tasks.back() == &task) {
+            own.tasks.pop_back();
+            queued--;
+            guard.unlock();
+            if (!task.cancelled)
+                execute(task);
+            return;
+        }
+    }
+    while (!task.done.load(std::memory_order_acquire)) {
+        task_t *other = steal(index);
+        if (other != nullptr)
+            execute(*other);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void ForkJoin::execute(task_t &task) {
+    task_t *outer = current;
+    current = &task;
+    try {
+        task.val = task.expr->interp(task.env);
+    } catch (const std::runtime_error &) {
+        task.error = std::current_exception();
+    }
+    current = outer;
+    if (task.root) {
+        std::lock_guard<std::mutex> guard(lock);
+        task.done = true;
+        done_cond.notify_all();
+    } else {
+        // The task belongs to the joining thread once this is set.
+        task.done.store(true, std::memory_order_release);
+    }
+}
+
+void ForkJoin::push(size_t i, task_t *task) {
+    {
+        std::lock_guard<std::mutex> guard(deques[i]->lock);
+        deques[i]->tasks.push_back(task);
+    }
+    queued++;
+    if (sleeping > 0) {
+        std::lock_guard<std::mutex> guard(lock);
+        work_cond.notify_one();
+    }
+}
+
+// A thread takes the newest task from its own deque, and steals the
+// oldest, usually largest, from another.
+ForkJoin::task_t *ForkJoin::steal(size_t i) {
+    for (size_t k = 0; k < deques.size(); k++) {
+        deque_t &deque = *deques[(i + k) % deques.size()];
+        std::lock_guard<std::mutex> guard(deque.lock);
+        if (deque.tasks.empty())
+            continue;
+        task_t *task;
+        if (k == 0) {
+            task = deque.tasks.back();
+            deque.tasks.pop_back();
+        } else {
+            task = deque.tasks.front();
+            deque.tasks.pop_front();
+        }
+        queued--;
+        return task;
+    }
+    return nullptr;
+}
+
+/* for tests */
+static std::string parallel_str(ForkJoin &pool, std::string s) {
+    try {
+        return pool.run(parse_str(s))->to_string();
+    } catch (const std::runtime_error &exn) {
+        return exn.what();
+    }
+}
+
+TEST_CASE("fork-join") {
+    ForkJoin pool(4);
+    std::string fib = "_letrec fib = _fun (x) _if x == 0 _then 1 _else _if x == 1 _then 1"
+                      "  _else fib(x + -1) + fib(x + -2) _in fib(";
+    CHECK(parallel_str(pool, fib + "15)") == "987");
+    CHECK(parallel_str(pool, "1 + 2 * 3") == "7");
+    CHECK(parallel_str(pool, "(_fun (x, y) x * y)(6, 7) == (_fun (x, y) y * x)(6, 7)") == "_true");
+    CHECK(parallel_str(pool, "_let x = 5 _in (_let y = x + 1 _in y * y) + (_let z = x * 2 _in z + z)") == "56");
+
+    // The left operand's error is thrown, as interp throws it.
+    CHECK(parallel_str(pool, "(" + fib + "10) + x) + (" + fib + "10) + _true)") == "free variable: x");
+    CHECK(parallel_str(pool, fib + "10) + (" + fib + "10) + _true)") == "not a number");
+    CHECK(parallel_str(pool, "(_fun (x) x)(" + fib + "10)) == (" + fib + "8) + y)") == "free variable: y");
+    // A right operand that never finishes is cancelled once the left one fails.
+    std::string loop = "_letrec loop = _fun (n) loop(n + 1) _in loop(0)";
+    CHECK(parallel_str(pool, "((_fun (y) y)(1) + x) + ((" + loop + ") + (_fun (y) y)(2))") == "free variable: x");
+    CHECK(parallel_str(pool, "(" + fib + "12) + _true) + (" + fib + "5) + " + loop + ")") == "not a number");
+
+    if (!values_are_thread_safe)
+        return;
+    CHECK(pool.forks() > 0);
+
+    // Programs can be run from several threads at once.
+    std::vector<std::string> results(4);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+        threads.push_back(std::thread([&, i]() { results[i] = parallel_str(pool, fib + std::to_string(10 + i) + ")"); }));
+    for (std::thread &t : threads)
+        t.join();
+    CHECK(results == std::vector<std::string>({"89", "144", "233", "377"}));
+}
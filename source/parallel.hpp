@@ -0,0 +1,171 @@
+//
+// Fork-join evaluation of independent subexpressions on a work-stealing thread pool.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "pointer.hpp"
+#include "Expr.hpp"
+
+/**
+ * A <code>ForkJoin</code> pool evaluates programs with <code>interp</code>, except that while one of its threads
+ * evaluates the two operands of an addition, multiplication, comparison or one-argument call, it can hand the right
+ * operand to another thread and evaluate the left one itself. Programs are pure and each binder has its own frame
+ * slot, so the operands cannot interfere.
+ * An operand is only handed off if both operands are worth it, meaning they may call a function or have at least
+ * <code>min_size</code> nodes, and a thread is idle to take it. Otherwise it is evaluated in place, so tasks stay
+ * coarse however deep the evaluation goes.
+ * Every thread keeps its own deque of handed-off operands, and an idle thread steals the oldest operand from another.
+ * Errors are the same as with <code>interp</code>. Once a left operand fails, the right one handed to another thread
+ * is cancelled, and stops at its next function call, so a right operand that would never finish cannot hold up the
+ * error.
+ * In builds whose reference counts are not atomic, a ForkJoin pool has one thread and evaluates everything in place.
+ */
+class ForkJoin {
+public:
+    /* Smallest operand without calls worth handing to another thread. */
+    static const size_t min_size = 64;
+
+    /* Set once at startup to the number of threads in the pool that <code>shared()</code> makes. */
+    static int shared_threads;
+
+    /**
+     * Starts the pool's threads.
+     * @param threads number of threads.
+     */
+    ForkJoin(int threads);
+
+    /**
+     * Stops the pool's threads once the programs being run have finished.
+     */
+    ~ForkJoin();
+
+    ForkJoin(const ForkJoin &) = delete;
+    ForkJoin &operator=(const ForkJoin &) = delete;
+
+    /**
+     * Returns a pool of <code>shared_threads</code> threads, made the first time it is needed.
+     * @return the shared pool.
+     */
+    static ForkJoin &shared();
+
+    /**
+     * Resolves an Expr's variables to frame slots and evaluates it on the pool. Can be called from any number of
+     * threads at once.
+     * /exception If the evaluation reaches a free variable, an error will be thrown.
+     * @param e Expr to be evaluated.
+     * @return Val representing the Expr solution or a semantically equivalent value.
+     */
+    PTR(Val) run(PTR(Expr) e);
+
+    /**
+     * @return number of operands handed to another thread so far.
+     */
+    long forks() const {
+        return forked;
+    }
+
+    /**
+     * Evaluates two operands in the same Env, on two threads if that is worth it. Used by the <code>interp</code>
+     * of Exprs with two independent operands.
+     * /exception If an operand's evaluation fails, the left one's error is thrown if both fail.
+     * @param lhs left operand.
+     * @param rhs right operand.
+     * @param env Env to evaluate both in.
+     * @param lhs_val set to the left operand's Val.
+     * @param rhs_val set to the right operand's Val.
+     */
+    static void interp_pair(const PTR(Expr) &lhs, const PTR(Expr) &rhs, const PTR(Env) &env,
+                            PTR(Val) &lhs_val, PTR(Val) &rhs_val) {
+        ForkJoin *pool = active;
+        if (pool != nullptr && worth_forking(lhs) && worth_forking(rhs) && pool->has_idle()) {
+            pool->interp_forked(lhs, rhs, env, lhs_val, rhs_val);
+        } else {
+            lhs_val = lhs->interp(env);
+            rhs_val = rhs->interp(env);
+        }
+    }
+
+    /**
+     * Stops the evaluation on this thread if it belongs to an operand that has been cancelled. Called at every
+     * function call, which any evaluation that does not finish keeps reaching.
+     * /exception If the operand has been cancelled, an error will be thrown.
+     */
+    static void check_cancelled() {
+        if (current != nullptr && current->is_cancelled())
+            throw std::runtime_error("cancelled");
+    }
+
+private:
+    struct task_t {
+        PTR(Expr) expr;
+        PTR(Env) env;
+        PTR(Val) val;
+        std::exception_ptr error;
+        // A whole program, whose caller waits on done_cond instead of helping.
+        bool root;
+        std::atomic<bool> done;
+        // Set once the task's result is no longer needed.
+        std::atomic<bool> cancelled;
+        // Task that handed this one off, which waits for it and so outlives it.
+        task_t *parent;
+
+        task_t(PTR(Expr) expr, PTR(Env) env, bool root, task_t *parent);
+
+        /**
+         * @return true if this task or one it was handed off by has been cancelled.
+         */
+        bool is_cancelled() const;
+    };
+
+    struct deque_t {
+        std::mutex lock;
+        std::deque<task_t *> tasks;
+    };
+
+    // The pool, and the deque, of the pool thread running on this thread.
+    inline static thread_local ForkJoin *active = nullptr;
+    inline static thread_local size_t index = 0;
+    // The task running on this thread, if it is a pool thread.
+    inline static thread_local task_t *current = nullptr;
+
+    std::vector<std::unique_ptr<deque_t>> deques;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_deque;
+    // Tasks waiting in the deques.
+    std::atomic<long> queued;
+    // Threads looking for a task.
+    std::atomic<long> idle;
+    std::atomic<long> sleeping;
+    std::atomic<long> forked;
+    std::atomic<bool> stopping;
+
+    std::mutex lock;
+    std::condition_variable work_cond;
+    std::condition_variable done_cond;
+
+    static bool worth_forking(const PTR(Expr) &e) {
+        return e->has_call || e->size >= min_size;
+    }
+
+    bool has_idle() const {
+        return queued.load(std::memory_order_relaxed) < idle.load(std::memory_order_relaxed);
+    }
+
+    void work(size_t i);
+    void interp_forked(const PTR(Expr) &lhs, const PTR(Expr) &rhs, const PTR(Env) &env,
+                       PTR(Val) &lhs_val, PTR(Val) &rhs_val);
+    void join(task_t &task);
+    void execute(task_t &task);
+    void push(size_t i, task_t *task);
+    task_t *steal(size_t i);
+};
@@ -2,17 +2,149 @@
 // Created by Austin Cunliffe on 1/13/20.
 //
 
+#include <climits>
+#include <iterator>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <vector>
 #include "parser.hpp"
 #include "catch.hpp"
+#include "arena.hpp"
+#include "lexer.hpp"
+#include "expr_factory.hpp"
+#include "Step.hpp"
+
+static std::string parse_keyword(Lexer &in);
+static std::string parse_alphabetic(Lexer &in, std::string prefix);
+static char peek_after_spaces(Lexer &in);
+
+/**
+ * A <code>Parser</code> runs the recursive-descent grammar below with an explicit stack. Each call that
+ * the recursive version would make is instead a frame recording what to do with the result of the nested
+ * parse, so inputs of any length or nesting depth are parsed in bounded C++ stack and in linear time.
+ */
+class Parser {
+public:
+    Parser(Lexer &in, PTR(Arena) arena, ExprFactory *factory) : in(in), arena(arena), factory(factory) { }
+
+    ~Parser() {
+        for (const Symbol &name : held)
+            name.drop();
+    }
+
+    PTR(Expr) parse_program();
+    PTR(Expr) parse_expr();
+
+private:
+    // What to parse next when descending.
+    typedef enum {
+        expr_goal,
+        comparg_goal,
+        addend_goal,
+        multicand_goal,
+        inner_goal
+    } goal_t;
+
+    // What to do with the Expr just parsed, named after the rule that
+    // was waiting for it.
+    typedef enum {
+        expr_after_lhs,
+        expr_equal,
+        comparg_after_lhs,
+        comparg_add,
+        addend_after_lhs,
+        addend_mult,
+        multicand_after_inner,
+        multicand_call,
+        inner_close,
+        let_after_rhs,
+        let_body,
+        if_after_test,
+        if_after_then,
+        if_after_else,
+        fun_body
+    } frame_tag_t;
+
+    typedef struct {
+        frame_tag_t tag;
+        PTR(Expr) first;
+        PTR(Expr) second;
+        Symbol name;
+        // Formal arguments of a function, or the arguments of a call
+        // parsed so far.
+        var_list_t names;
+        std::vector<PTR(Expr)> args;
+    } frame_t;
+
+    Lexer &in;
+    // Arena that nodes are allocated into, or nullptr to allocate
+    // each node separately.
+    PTR(Arena) arena;
+    // Factory that nodes are shared through, or nullptr.
+    ExprFactory *factory;
+    std::vector<frame_t> frames;
+    // Names in frames, held until the parse is done, since no node holds
+    // them until their rule finishes.
+    std::vector<Symbol> held;
+    goal_t goal;
+    PTR(Expr) result;
+
+    template <typename T, typename... Args>
+    PTR(Expr) new_expr(Args... args) {
+        if (factory != nullptr)
+            return factory->make<T>(args...);
+        if (arena != nullptr)
+            return ARENA_NEW(arena, T, args...);
+        return NEW(T)(args...);
+    }
+
+    void push(frame_tag_t tag, PTR(Expr) first = nullptr, PTR(Expr) second = nullptr, Symbol name = Symbol()) {
+        frames.push_back({tag, first, second, hold(name), nullptr, {}});
+    }
+
+    Symbol hold(const Symbol &name) {
+        if (name != Symbol()) {
+            name.hold();
+            held.push_back(name);
+        }
+        return name;
+    }
+
+    bool start_inner();
+    void start_fun(Symbol self_name);
+    bool start_multicand_call(PTR(Expr) expr);
+    bool finish(frame_t &f);
+    PTR(Expr) parse_number();
+    PTR(Expr) parse_variable();
+};
 
 // Take an input stream that contains an expression,
 // and returns the parsed representation of that expression.
 // Throws `runtime_error` for parse_expr errors.
 PTR(Expr)parse(std::istream &in) {
-    PTR(Expr)e = parse_expr(in);
+    return parse(in, nullptr);
+}
+
+// The stream is read into memory once and parsed from there.
+PTR(Expr)parse(std::istream &in, PTR(Arena) arena) {
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return parse(text, arena);
+}
+
+PTR(Expr)parse(std::string_view text, PTR(Arena) arena) {
+    Lexer in(text);
+    return Parser(in, arena, nullptr).parse_program();
+}
+
+PTR(Expr)parse(std::string_view text, ExprFactory &factory) {
+    Lexer in(text);
+    return Parser(in, nullptr, &factory).parse_program();
+}
+
+// Parses an expression that must make up the whole input.
+PTR(Expr) Parser::parse_program() {
+    PTR(Expr)e = parse_expr();
 
     // This peek is currently redundant, since we would have
     // consumed whitespace to decide that the expression
@@ -22,238 +154,337 @@ PTR(Expr)parse(std::istream &in) {
         throw std::runtime_error((std::string)"expected end of file at " + c);
 
     return e;
-
 }
 
-// Take an input stream that starts with an expression.
-// Checks whether we have an EqualExpr.
-PTR(Expr)parse_expr(std::istream &in) {
-    PTR(Expr)e = parse_comparg(in);
+// Parses an expression. Descending pushes one frame per rule entered,
+// until an inner expression either is a complete leaf or starts a new
+// nested goal. Each finished Expr is then handed to the frame on top.
+PTR(Expr) Parser::parse_expr() {
+    bool descending = true;
+    goal = expr_goal;
 
-    char c = peek_after_spaces(in);
-    if (c == '=') {
-        c = in.get();
-        c = in.get();
-        if (c == '=') {
-            PTR(Expr)rhs = parse_expr(in);
-            return NEW(EqualExpr)(e, rhs);
+    while (1) {
+        if (descending) {
+            switch (goal) {
+                case expr_goal:
+                    push(expr_after_lhs);
+                    goal = comparg_goal;
+                    break;
+                case comparg_goal:
+                    push(comparg_after_lhs);
+                    goal = addend_goal;
+                    break;
+                case addend_goal:
+                    push(addend_after_lhs);
+                    goal = multicand_goal;
+                    break;
+                case multicand_goal:
+                    push(multicand_after_inner);
+                    goal = inner_goal;
+                    break;
+                case inner_goal:
+                    descending = start_inner();
+                    break;
+            }
+        } else {
+            if (frames.empty())
+                return result;
+            frame_t f = std::move(frames.back());
+            frames.pop_back();
+            descending = finish(f);
         }
     }
-
-    return e;
 }
 
-// Takes an input stream that starts with an expression,
-// consuming the largest initial expression possible.
-static PTR(Expr)parse_comparg(std::istream &in) {
-    PTR(Expr)e = parse_addend(in);
-
+// Parses something with no immediate `+` or `*` from `in`. Returns
+// false with `result` set when it is a leaf, or true after pushing a
+// frame and setting the goal for the nested Expr it needs first.
+bool Parser::start_inner() {
     char c = peek_after_spaces(in);
 
-    if (c == '+') {
-        in >> c;
-        PTR(Expr)rhs = parse_comparg(in);
-        e = NEW(AddExpr)(e, rhs);
+    if (c == '(') {
+        c = in.get();
+        push(inner_close);
+        goal = comparg_goal;
+        return true;
+    } else if (isdigit(c) || c == '-') {
+        result = parse_number();
+        return false;
+    } else if (isalpha(c)) {
+        result = parse_variable();
+        return false;
+    } else if (c == '_') {
+        std::string keyword = parse_keyword(in);
+        if (keyword == "_true") {
+            result = new_expr<BoolExpr>(true);
+            return false;
+        } else if (keyword == "_false") {
+            result = new_expr<BoolExpr>(false);
+            return false;
+        } else if (keyword == "_let") {
+            peek_after_spaces(in);
+            std::string var_name(in.scan_alphabetic());
+            // Peek next char, should be '=', then consume.
+            if (peek_after_spaces(in) != '=') {
+                throw std::runtime_error((std::string)"expected =");
+            }
+            c = in.get();
+            push(let_after_rhs, nullptr, nullptr, var_name);
+            goal = comparg_goal;
+            return true;
+        } else if (keyword == "_if") {
+            peek_after_spaces(in);
+            push(if_after_test);
+            goal = expr_goal;
+            return true;
+        } else if (keyword == "_letrec") {
+            peek_after_spaces(in);
+            std::string var_name(in.scan_alphabetic());
+            if (peek_after_spaces(in) != '=') {
+                throw std::runtime_error((std::string)"expected =");
+            }
+            c = in.get();
+            if (peek_after_spaces(in) != '_' || parse_keyword(in) != "_fun")
+                throw std::runtime_error((std::string)"expected _fun in _letrec");
+            push(let_after_rhs, nullptr, nullptr, var_name);
+            start_fun(var_name);
+            return true;
+        } else if (keyword == "_fun") {
+            // A name before the arguments makes the function recursive.
+            std::string self_name;
+            if (isalpha(peek_after_spaces(in)))
+                self_name = parse_alphabetic(in, "");
+            start_fun(self_name);
+            return true;
+        } else {
+            throw std::runtime_error((std::string)"unexpected keyword " + keyword);
+        }
+    } else {
+        throw std::runtime_error((std::string)"expected a digit or open parenthesis at " + c);
     }
-
-    return e;
 }
 
-// Takes an input stream that starts with an addend,
-// consuming the largest initial addend possible, where
-// an addend is an expression that does not have `+`
-// except within nested expressions (like parentheses).
-static PTR(Expr)parse_addend(std::istream &in) {
-    PTR(Expr)e = parse_multicand(in);
-
+// Parses the arguments of a function, `(<name>, ...)`, and sets the
+// goal for its body.
+void Parser::start_fun(Symbol self_name) {
     char c = peek_after_spaces(in);
-    if (c == '*') {
-        c = in.get();
-        PTR(Expr)rhs = parse_addend(in);
-        e = NEW(MultExpr)(e, rhs);
+    if (c != '(') throw std::runtime_error((std::string) "expected ( in function");
+    in.get();
+    std::vector<Symbol> formal_args;
+    formal_args.push_back(hold(parse_alphabetic(in, "")));
+
+    c = peek_after_spaces(in);
+    while (c == ',') {
+        in.get();
+        peek_after_spaces(in);
+        formal_args.push_back(hold(parse_alphabetic(in, "")));
+        c = peek_after_spaces(in);
     }
+    if (c != ')') throw std::runtime_error((std::string) "expected ) in function");
+    in.get();
 
-    return e;
+    push(fun_body, nullptr, nullptr, self_name);
+    frames.back().names = std::make_shared<const std::vector<Symbol>>(std::move(formal_args));
+    goal = expr_goal;
 }
 
-static PTR(Expr)parse_multicand(std::istream &in) {
-    PTR(Expr)expr = parse_inner(in);
-
-    while (in.peek() == '(') {
-        in.get();
-        PTR(Expr)actual_arg = parse_expr(in);
-        expr = NEW(CallExpr)(expr, actual_arg);
+// A multicand is an inner expression followed by any number of calls,
+// with no space before each `(`.
+bool Parser::start_multicand_call(PTR(Expr) expr) {
+    if (in.peek() == '(') {
         in.get();
+        push(multicand_call, expr);
+        goal = expr_goal;
+        return true;
     }
-    return expr;
+    result = expr;
+    return false;
 }
 
-// Parses something with no immediate `+` or `*` from `in`.
-static PTR(Expr)parse_inner(std::istream &in) {
-    PTR(Expr)e;
-
-    char c = peek_after_spaces(in);
+// Continues the rule that was waiting for `result`. Returns true if
+// it needs another nested Expr, after setting the goal for it.
+bool Parser::finish(frame_t &f) {
+    char c;
 
-    if (c == '(') {
-        c = in.get();
-        e = parse_comparg(in);
-        c = peek_after_spaces(in);
-        if (c == ')')
-            c = in.get();
-        else
-            throw std::runtime_error("expected a close parenthesis");
-    } else if (isdigit(c) || c == '-') {
-        e = parse_number(in);
-    } else if (isalpha(c)) {
-        e = parse_variable(in);
-    } else if (c == '_') {
-        std::string keyword = parse_keyword(in);
-        if (keyword == "_true")
-            return NEW(BoolExpr)(true);
-        else if (keyword == "_false")
-            return NEW(BoolExpr)(false);
-        else if (keyword == "_let")
-            e = parse_let(in);
-        else if (keyword == "_if")
-            e = parse_if(in);
-        else if (keyword == "_fun")
-            e = parse_fun(in);
-        else
-            throw std::runtime_error((std::string)"unexpected keyword " + keyword);
-    } else {
-        throw std::runtime_error((std::string)"expected a digit or open parenthesis at " + c);
+    switch (f.tag) {
+        // An expression is a comparg, optionally followed by `==` and
+        // another expression.
+        case expr_after_lhs:
+            c = peek_after_spaces(in);
+            if (c == '=') {
+                c = in.get();
+                c = in.get();
+                if (c == '=') {
+                    push(expr_equal, result);
+                    goal = expr_goal;
+                    return true;
+                }
+            }
+            return false;
+        case expr_equal:
+            result = new_expr<EqualExpr>(f.first, result);
+            return false;
+
+        // A comparg is an addend, optionally followed by `+` and
+        // another comparg.
+        case comparg_after_lhs:
+            c = peek_after_spaces(in);
+            if (c == '+') {
+                c = in.get();
+                push(comparg_add, result);
+                goal = comparg_goal;
+                return true;
+            }
+            return false;
+        case comparg_add:
+            result = new_expr<AddExpr>(f.first, result);
+            return false;
+
+        // An addend is a multicand, optionally followed by `*` and
+        // another addend.
+        case addend_after_lhs:
+            c = peek_after_spaces(in);
+            if (c == '*') {
+                c = in.get();
+                push(addend_mult, result);
+                goal = addend_goal;
+                return true;
+            }
+            return false;
+        case addend_mult:
+            result = new_expr<MultExpr>(f.first, result);
+            return false;
+
+        case multicand_after_inner:
+            return start_multicand_call(result);
+        case multicand_call:
+            // Arguments are separated by `,`, and the character closing
+            // the last one is consumed unchecked.
+            if (peek_after_spaces(in) == ',') {
+                in.get();
+                f.args.push_back(result);
+                frames.push_back(std::move(f));
+                goal = expr_goal;
+                return true;
+            }
+            if (f.args.empty()) {
+                result = new_expr<CallExpr>(f.first, result);
+            } else {
+                f.args.push_back(result);
+                result = new_expr<CallExpr>(f.first, std::move(f.args));
+            }
+            in.get();
+            return start_multicand_call(result);
+
+        case inner_close:
+            c = peek_after_spaces(in);
+            if (c == ')')
+                c = in.get();
+            else
+                throw std::runtime_error("expected a close parenthesis");
+            return false;
+
+        // _let <name> = <comparg> _in <comparg>, and
+        // _letrec <name> = _fun (<name>, ...) <expr> _in <comparg>
+        case let_after_rhs: {
+            c = peek_after_spaces(in);
+
+            // Check for syntax error in _in.
+            std::string _in = "";
+            while (!isspace(in.peek())) {
+                if (_in.length() >= 3) {
+                    throw std::runtime_error((std::string)"invalid _in syntax");
+                }
+                _in += in.get();
+            }
+            if (_in != "_in") {
+                throw std::runtime_error((std::string)"invalid _in syntax");
+            }
+            push(let_body, result, nullptr, f.name);
+            goal = comparg_goal;
+            return true;
+        }
+        case let_body:
+            result = new_expr<LetExpr>(f.name, f.first, result);
+            return false;
+
+        // _if <expr> _then <comparg> _else <comparg>
+        case if_after_test:
+            if (peek_after_spaces(in) != '_' || parse_keyword(in) != "_then")
+                throw std::runtime_error((std::string) "expected _then");
+            push(if_after_then, result);
+            goal = comparg_goal;
+            return true;
+        case if_after_then:
+            if (peek_after_spaces(in) != '_' || parse_keyword(in) != "_else")
+                throw std::runtime_error((std::string)"expected _else");
+            push(if_after_else, f.first, result);
+            goal = comparg_goal;
+            return true;
+        case if_after_else:
+            result = new_expr<IfExpr>(f.first, f.second, result);
+            return false;
+
+        // _fun [<name>] (<name>, ...) <expr>
+        case fun_body:
+            if (f.name.str().empty())
+                result = new_expr<FunExpr>(f.names, result);
+            else
+                result = new_expr<FunExpr>(f.name, f.names, result);
+            return false;
     }
-
-    return e;
+    return false;
 }
 
 // Parses a number, assuming that `in` starts with a digit.
-static PTR(Expr)parse_number(std::istream &in) {
+PTR(Expr) Parser::parse_number() {
     char c = peek_after_spaces(in);
 
     if (c == '-') c = in.get();
 
-    if (!isnumber(peek_after_spaces(in))) {
+    if (!isdigit(peek_after_spaces(in))) {
         throw std::runtime_error((std::string)"expected number after -");
     }
 
-    int num = 0;
-    in >> num;
-    if (c == '-') num *= -1;
+    // Numbers too large for an int64_t overflow, as arithmetic does. A
+    // negative number is accumulated as one, so INT64_MIN still fits.
+    std::string_view digits = in.scan_digits();
+    int64_t num = 0;
+    int sign = (c == '-') ? -1 : 1;
+    for (char d : digits) {
+        if (__builtin_mul_overflow(num, 10, &num) || __builtin_add_overflow(num, sign * (d - '0'), &num)) {
+            if (!NumVal::promote_on_overflow)
+                throw std::runtime_error("integer overflow");
+            return new_expr<NumExpr>(BigInt::parse(digits, c == '-'));
+        }
+    }
 
-    return NEW(NumExpr)(num);
+    return new_expr<NumExpr>(num);
 }
 
 // Parses an expression, assuming that `in` starts with a
 // letter.
-static PTR(Expr)parse_variable(std::istream &in) {
-    return NEW(VarExpr)(parse_alphabetic(in, ""));
+PTR(Expr) Parser::parse_variable() {
+    return new_expr<VarExpr>(parse_alphabetic(in, ""));
 }
 
 // Parses an expression, assuming that `in` starts with a
 // letter.
-static std::string parse_keyword(std::istream &in) {
+static std::string parse_keyword(Lexer &in) {
     in.get(); // consume `_`
     return parse_alphabetic(in, "_");
 }
 
-// Parses an expression, assuming that 'in' starts with an
-// underscore.
-static PTR(Expr)parse_let(std::istream &in) {
-
-    peek_after_spaces(in);
-    std::string var_name = "";
-    while (1) {
-        char c = in.peek();
-        if (!isalpha(c))
-            break;
-        var_name += in.get();
-    }
-    // Peek next char, should be '=', then consume.
-    if (peek_after_spaces(in) != '=') {
-        throw std::runtime_error((std::string)"expected =");
-    }
-    char c = in.get();
-
-    PTR(Expr)lhs = parse_comparg(in);
-
-    c = peek_after_spaces(in);
-
-    // Check for syntax error in _in.
-    std::string _in = "";
-    while (!isspace(in.peek())) {
-        if (_in.length() >= 3) {
-            throw std::runtime_error((std::string)"invalid _in syntax");
-        }
-        _in += in.get();
-    }
-    if (_in != "_in") {
-        throw std::runtime_error((std::string)"invalid _in syntax");
-    }
-
-    PTR(Expr)rhs = parse_comparg(in);
-
-    return NEW(LetExpr)(var_name, lhs, rhs);
-}
-
-static PTR(Expr)parse_if(std::istream &in) {
-    char c = peek_after_spaces(in);
-    PTR(Expr)test_part = parse_expr(in);
-
-    std::string keyword;
-    if (peek_after_spaces(in) != '_')
-        throw std::runtime_error((std::string) "expected _then");
-
-    keyword = parse_keyword(in);
-    if (keyword != "_then")
-        throw std::runtime_error((std::string) "expected _then");
-
-
-    PTR(Expr)then_part = parse_comparg(in);
-
-    if (peek_after_spaces(in) != '_')
-        throw std::runtime_error((std::string)"expected _else");
-
-    keyword = parse_keyword(in);
-    if (keyword != "_else")
-        throw std::runtime_error((std::string)"expected _else");
-
-    PTR(Expr)else_part = parse_comparg(in);
-
-    return NEW(IfExpr)(test_part, then_part, else_part);
-}
-
-static PTR(Expr)parse_fun(std::istream &in) {
-    char c = peek_after_spaces(in);
-    if (c != '(') throw std::runtime_error((std::string) "expected ( in function");
-    in.get();
-    std::string formal_arg = parse_alphabetic(in, "");
-
-    c = peek_after_spaces(in);
-    if (c != ')') throw std::runtime_error((std::string) "expected ) in function");
-    in.get();
-
-    PTR(Expr)actual_arg = parse_expr(in);
-
-    return NEW(FunExpr)(formal_arg, actual_arg);
-}
-
 // Parses an expression, assuming that `in` starts with a
 // letter.
-static std::string parse_alphabetic(std::istream &in, std::string prefix) {
-    std::string name = prefix;
-    while (1) {
-        char c = in.peek();
-        if (!isalpha(c))
-            break;
-        name += in.get();
-    }
-    return name;
+static std::string parse_alphabetic(Lexer &in, std::string prefix) {
+    std::string_view letters = in.scan_alphabetic();
+    return prefix.append(letters.data(), letters.size());
 }
 
 // Like in.peek(), but consume an whitespace at the
 // start of `in`
-static char peek_after_spaces(std::istream &in) {
+static char peek_after_spaces(Lexer &in) {
     char c;
     while (1) {
         c = in.peek();
@@ -266,15 +497,13 @@ static char peek_after_spaces(std::istream &in) {
 
 /* for tests */
 PTR(Expr)parse_str(std::string s) {
-    std::istringstream in(s);
-    return parse(in);
+    return parse(s, nullptr);
 }
 
 /* for tests */
 std::string parse_str_error(std::string s) {
-    std::istringstream in(s);
     try {
-        (void) parse(in);
+        (void) parse(s, nullptr);
         return "";
     } catch (std::runtime_error exn) {
         return exn.what();
@@ -355,4 +584,71 @@ TEST_CASE( "See if this works" ) {
                     NEW(VarExpr)("y"))))), NEW(CallExpr)(NEW(CallExpr)(NEW(VarExpr)("f"), NEW(NumExpr)(2)),
                             NEW(NumExpr)(3)))));
     CHECK( parse_str("(f(10))")->equals(NEW(CallExpr)(NEW(VarExpr)("f"), NEW(NumExpr)(10))));
-}
\ No newline at end of file
+    CHECK( parse_str("_fun (a, b,c) a")->equals(NEW(FunExpr)(std::make_shared<const std::vector<Symbol>>(
+            std::vector<Symbol>({"a", "b", "c"})), NEW(VarExpr)("a"))));
+    CHECK( parse_str("f(1 , x + 2)(3)")->equals(NEW(CallExpr)(NEW(CallExpr)(NEW(VarExpr)("f"), std::vector<PTR(Expr)>(
+            {NEW(NumExpr)(1), NEW(AddExpr)(NEW(VarExpr)("x"), NEW(NumExpr)(2))})), NEW(NumExpr)(3))));
+    CHECK( parse_str_error("_fun (a b) a") == "expected ) in function" );
+    CHECK( parse_str("_fun f (a) f(a)")->equals(NEW(FunExpr)("f", std::make_shared<const std::vector<Symbol>>(1, "a"),
+            NEW(CallExpr)(NEW(VarExpr)("f"), NEW(VarExpr)("a")))));
+    CHECK( parse_str("_letrec f = _fun (a) a _in f")->equals(parse_str("_let f = _fun f (a) a _in f")));
+    CHECK( parse_str_error("_letrec f = 1 _in f") == "expected _fun in _letrec" );
+}
+
+TEST_CASE("parse from memory") {
+    std::string program = "_let fib = _fun (fib) _fun (x) _if x == 0 _then 1 _else x * fib(fib)(x + -1) _in fib(fib)(5)";
+    std::istringstream in(program);
+    PTR(Expr) from_stream = parse(in);
+    CHECK( parse(std::string_view(program), nullptr)->equals(from_stream) );
+
+    // Only the span passed in is parsed, not the rest of the buffer.
+    CHECK( parse(std::string_view("12 + xyz ) junk").substr(0, 8), nullptr)
+                   ->equals(NEW(AddExpr)(NEW(NumExpr)(12), NEW(VarExpr)("xyz"))) );
+    CHECK( parse_str_error("12 + xyz ) junk") == "expected end of file at )" );
+
+    CHECK( parse_str("99999999999")->equals(NEW(NumExpr)(99999999999)) );
+    CHECK( parse_str("9223372036854775807")->equals(NEW(NumExpr)(INT64_MAX)) );
+    CHECK( parse_str("-9223372036854775808")->equals(NEW(NumExpr)(INT64_MIN)) );
+    CHECK( parse_str_error("99999999999999999999") == "integer overflow" );
+    CHECK( parse_str_error("-9223372036854775809") == "integer overflow" );
+    CHECK( parse_str_error("_let x = 1 _in(x)") == "invalid _in syntax" );
+    CHECK( parse_str_error("f (1)") == "expected end of file at (" );
+}
+
+TEST_CASE("parse long and deeply nested input") {
+    const int n = 200000;
+
+    std::string sum = "1";
+    for (int i = 1; i < n; i++)
+        sum += " + 1";
+    PTR(Expr) e = parse_str(sum);
+    int terms = 1;
+    bool all_ones = true;
+    while (CAST(AddExpr)(e) != nullptr) {
+        all_ones = all_ones && CAST(AddExpr)(e)->lhs->equals(NEW(NumExpr)(1));
+        e = CAST(AddExpr)(e)->rhs;
+        terms++;
+    }
+    CHECK(all_ones);
+    CHECK(terms == n);
+    // The parsed chain can also be resolved and evaluated without recursing per term.
+    CHECK( Step::interp_by_steps(parse_str(sum))->equals(NEW(NumVal)(n)) );
+
+    std::string nested = std::string(n, '(') + "x" + std::string(n, ')');
+    CHECK( parse_str(nested)->equals(NEW(VarExpr)("x")) );
+    CHECK( parse_str_error(std::string(n, '(') + "x" + std::string(n - 1, ')')) == "expected a close parenthesis" );
+
+    std::string calls = "f";
+    for (int i = 0; i < 1000; i++)
+        calls += "(_if x == 1 _then _fun (y) y * 2 _else _let z = " + std::to_string(i) + " _in z)";
+    e = parse_str(calls);
+    for (int i = 999; i >= 0; i--) {
+        PTR(CallExpr) call = CAST(CallExpr)(e);
+        REQUIRE(call != nullptr);
+        CHECK( call->actual_args[0]->equals(NEW(IfExpr)(NEW(EqualExpr)(NEW(VarExpr)("x"), NEW(NumExpr)(1)),
+                NEW(FunExpr)("y", NEW(MultExpr)(NEW(VarExpr)("y"), NEW(NumExpr)(2))),
+                NEW(LetExpr)("z", NEW(NumExpr)(i), NEW(VarExpr)("z")))) );
+        e = call->to_be_called;
+    }
+    CHECK( e->equals(NEW(VarExpr)("f")) );
+}
@@ -4,27 +4,45 @@
 
 #pragma once
 
+#include <iostream>
+#include <string_view>
 #include "Expr.hpp"
 #include "pointer.hpp"
+
+class Arena;
+class ExprFactory;
+
 /**
  * Receives a istream representation of an Expr and parses it into an Expr.
  * @param in istream to parse.
  * @return Expr that has been parsed from the istream.
  */
 PTR(Expr)parse(std::istream &in);
-static PTR(Expr)parse_expr(std::istream &in);
-static PTR(Expr)parse_comparg(std::istream &in);
-static PTR(Expr)parse_addend(std::istream &in);
-static PTR(Expr)parse_multicand(std::istream &in);
-static PTR(Expr)parse_inner(std::istream &in);
-static PTR(Expr)parse_number(std::istream &in);
-static PTR(Expr)parse_variable(std::istream &in);
-static PTR(Expr)parse_let(std::istream &in);
-static PTR(Expr)parse_if(std::istream &in);
-static PTR(Expr)parse_fun(std::istream &in);
-static std::string parse_keyword(std::istream &in);
-static std::string parse_alphabetic(std::istream &in, std::string prefix);
-static char peek_after_spaces(std::istream &in);
+
+/**
+ * Receives a istream representation of an Expr and parses it into an Expr whose nodes are allocated from an Arena.
+ * The nodes keep the Arena alive, and its memory is released at once when the last of them is destroyed.
+ * @param in istream to parse.
+ * @param arena Arena to allocate nodes from, or nullptr to allocate them one at a time.
+ * @return Expr that has been parsed from the istream.
+ */
+PTR(Expr)parse(std::istream &in, PTR(Arena) arena);
+
+/**
+ * Parses an Expr from text that is already in memory, such as a mapped file, without copying it.
+ * @param text source text to parse.
+ * @param arena Arena to allocate nodes from, or nullptr to allocate them one at a time.
+ * @return Expr that has been parsed from the text.
+ */
+PTR(Expr)parse(std::string_view text, PTR(Arena) arena);
+
+/**
+ * Parses an Expr from text, sharing every subtree that is equal to one the ExprFactory has already made.
+ * @param text source text to parse.
+ * @param factory ExprFactory to make nodes with.
+ * @return Expr that has been parsed from the text.
+ */
+PTR(Expr)parse(std::string_view text, ExprFactory &factory);
 
 /**
  * Receives a string representation of an Expr and parses it into an Expr.
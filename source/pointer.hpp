@@ -2,6 +2,8 @@
 // Created by Austin Cunliffe on 3/2/20.
 //
 
+#pragma once
+
 #if 0
 
 # define NEW(T) new T
@@ -9,13 +11,35 @@
 # define CAST(T) dynamic_cast<T*>
 # define THIS this
 # define ENABLE_THIS(T) /* empty */
+# define ARENA_NEW(A, T, ...) new ((A)->allocate(sizeof(T), alignof(T))) T(__VA_ARGS__)
+
+#elif defined(MSD_INTRUSIVE_PTR)
+
+# include "ref.hpp"
+# define NEW(T) make_ref<T>
+# define PTR(T) Ref<T>
+# define CAST(T) ref_cast<T>
+# define THIS this
+# define ENABLE_THIS(T) : public RefCounted
+# define ARENA_NEW(A, T, ...) make_ref_in<T>(A, __VA_ARGS__)
 
 #else
 
+# include <memory>
 # define NEW(T) std::make_shared<T>
 # define PTR(T) std::shared_ptr<T>
 # define CAST(T) std::dynamic_pointer_cast<T>
 # define THIS shared_from_this()
 # define ENABLE_THIS(T) : public std::enable_shared_from_this<T>
+# define ARENA_NEW(A, T, ...) std::allocate_shared<T>(ArenaAllocator<T>(A), __VA_ARGS__)
 
 #endif
+
+/* True if PTR()s to one value can be copied and released on several threads at once. Intrusive counts are
+   not atomic unless MSD_ATOMIC_REFCOUNT is defined, and values such as small numbers are shared by every
+   program, so without it each program must stay on one thread. */
+#if defined(MSD_INTRUSIVE_PTR) && !defined(MSD_ATOMIC_REFCOUNT)
+constexpr bool values_are_thread_safe = false;
+#else
+constexpr bool values_are_thread_safe = true;
+#endif
@@ -0,0 +1,32 @@
+//
+// Intrusive reference counting, used by PTR() when MSD_INTRUSIVE_PTR is defined.
+//
+
+#include "pointer.hpp"
+
+#ifdef MSD_INTRUSIVE_PTR
+
+#include "arena.hpp"
+
+void RefCounted::destroy() const {
+    if (arena == nullptr) {
+        delete this;
+        return;
+    }
+
+    // The memory belongs to the arena, so only run the destructor.
+    Arena *owner = arena;
+    this->~RefCounted();
+    owner->release();
+}
+
+void *arena_place(Arena *arena, size_t size, size_t align) {
+    return arena->allocate(size, align);
+}
+
+void arena_adopt(Arena *arena, RefCounted *obj) {
+    obj->arena = arena;
+    arena->retain();
+}
+
+#endif
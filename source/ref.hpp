@@ -0,0 +1,139 @@
+//
+// Intrusive reference counting, used by PTR() when MSD_INTRUSIVE_PTR is defined.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#ifdef MSD_ATOMIC_REFCOUNT
+#include <atomic>
+#endif
+
+class Arena;
+
+/**
+ * Base class for objects managed by <code>Ref</code>. The count lives in the object itself, so taking a
+ * reference never allocates. It is a plain int unless MSD_ATOMIC_REFCOUNT is defined, in which case references
+ * can be shared across threads.
+ */
+class RefCounted {
+public:
+#ifdef MSD_ATOMIC_REFCOUNT
+    mutable std::atomic<int> refcount;
+#else
+    mutable int refcount;
+#endif
+    // Set when the object was placed in an Arena, which then owns its memory.
+    Arena *arena;
+
+    RefCounted() : refcount(0), arena(nullptr) { }
+    RefCounted(const RefCounted &other) : refcount(0), arena(nullptr) { }
+    RefCounted &operator=(const RefCounted &other) { return *this; }
+    virtual ~RefCounted() { }
+
+    void retain() const {
+#ifdef MSD_ATOMIC_REFCOUNT
+        refcount.fetch_add(1, std::memory_order_relaxed);
+#else
+        refcount++;
+#endif
+    }
+
+    void release() const {
+#ifdef MSD_ATOMIC_REFCOUNT
+        if (refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            destroy();
+#else
+        if (--refcount == 0)
+            destroy();
+#endif
+    }
+
+    int use_count() const {
+        return refcount;
+    }
+
+private:
+    void destroy() const;
+};
+
+/**
+ * Smart pointer to a <code>RefCounted</code> object. It can be made from a raw pointer at any time, which is
+ * what lets <code>THIS</code> be plain <code>this</code>.
+ */
+template <typename T>
+class Ref {
+public:
+    Ref() : p(nullptr) { }
+    Ref(std::nullptr_t) : p(nullptr) { }
+    Ref(T *p) : p(p) { if (p) p->retain(); }
+    Ref(const Ref &other) : p(other.p) { if (p) p->retain(); }
+    Ref(Ref &&other) : p(other.p) { other.p = nullptr; }
+
+    template <typename U>
+    Ref(const Ref<U> &other) : p(other.get()) { if (p) p->retain(); }
+
+    template <typename U>
+    Ref(Ref<U> &&other) : p(other.detach()) { }
+
+    ~Ref() { if (p) p->release(); }
+
+    Ref &operator=(Ref other) {
+        std::swap(p, other.p);
+        return *this;
+    }
+
+    T *operator->() const { return p; }
+    T &operator*() const { return *p; }
+    T *get() const { return p; }
+    explicit operator bool() const { return p != nullptr; }
+    long use_count() const { return p ? p->use_count() : 0; }
+
+    // Gives up ownership without releasing the reference.
+    T *detach() {
+        T *q = p;
+        p = nullptr;
+        return q;
+    }
+
+private:
+    T *p;
+};
+
+template <typename T, typename U>
+bool operator==(const Ref<T> &a, const Ref<U> &b) { return a.get() == b.get(); }
+
+template <typename T, typename U>
+bool operator!=(const Ref<T> &a, const Ref<U> &b) { return a.get() != b.get(); }
+
+template <typename T>
+bool operator==(const Ref<T> &a, std::nullptr_t) { return a.get() == nullptr; }
+
+template <typename T>
+bool operator!=(const Ref<T> &a, std::nullptr_t) { return a.get() != nullptr; }
+
+template <typename T, typename... Args>
+Ref<T> make_ref(Args &&... args) {
+    return Ref<T>(new T(std::forward<Args>(args)...));
+}
+
+template <typename T, typename U>
+Ref<T> ref_cast(const Ref<U> &r) {
+    return Ref<T>(dynamic_cast<T *>(r.get()));
+}
+
+/**
+ * Constructs an object in an Arena. The object keeps the Arena alive, and its memory is returned with the rest
+ * of the Arena's.
+ */
+void *arena_place(Arena *arena, size_t size, size_t align);
+void arena_adopt(Arena *arena, RefCounted *obj);
+
+template <typename T, typename... Args>
+Ref<T> make_ref_in(const Ref<Arena> &arena, Args &&... args) {
+    T *obj = new (arena_place(arena.get(), sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    arena_adopt(arena.get(), obj);
+    return Ref<T>(obj);
+}
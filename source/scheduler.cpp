@@ -0,0 +1,214 @@
+//
+// Runs many step-mode evaluations at once by taking turns on a few threads.
+//
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "scheduler.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+Scheduler::task_t::task_t(PTR(Expr) e, callback_t done) : step(e) {
+    this->done = done;
+    this->steps = 0;
+    this->started = std::chrono::steady_clock::now();
+}
+
+Scheduler::Scheduler(int threads, long slice) {
+    this->slice = std::max(slice, 1L);
+    this->next_queue = 0;
+    this->queued = 0;
+    this->pending = 0;
+    this->stopping = false;
+    // Without threads, evaluations run on the thread that submits them.
+    threads = values_are_thread_safe ? std::max(threads, 0) : 0;
+
+    for (int i = 0; i < std::max(threads, 1); i++)
+        queues.push_back(std::make_unique<queue_t>());
+    for (int i = 0; i < threads; i++)
+        this->threads.push_back(std::thread([this, i]() { work(i); }));
+}
+
+Scheduler::~Scheduler() {
+    stop();
+}
+
+void Scheduler::submit(PTR(Expr) e, callback_t done) {
+    bool stopped;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopped = stopping;
+        if (!stopped)
+            pending++;
+    }
+    if (stopped) {
+        done(nullptr, std::make_exception_ptr(std::runtime_error("scheduler stopped")));
+        return;
+    }
+
+    push(next_queue++ % queues.size(), std::make_unique<task_t>(e, done));
+    std::lock_guard<std::mutex> guard(lock);
+    work_cond.notify_one();
+}
+
+std::future<PTR(Val)> Scheduler::submit(PTR(Expr) e) {
+    std::shared_ptr<std::promise<PTR(Val)>> promise = std::make_shared<std::promise<PTR(Val)>>();
+    std::future<PTR(Val)> result = promise->get_future();
+    submit(e, [promise](PTR(Val) val, std::exception_ptr error) {
+        if (error)
+            promise->set_exception(error);
+        else
+            promise->set_value(val);
+    });
+    return result;
+}
+
+void Scheduler::wait() {
+    if (threads.empty()) {
+        while (std::unique_ptr<task_t> task = take(0)) {
+            if (!advance(*task))
+                push(0, std::move(task));
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    idle_cond.wait(guard, [this]() { return pending == 0; });
+}
+
+void Scheduler::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_cond.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+    threads.clear();
+
+    for (size_t i = 0; i < queues.size(); i++) {
+        while (std::unique_ptr<task_t> task = take(i))
+            finish(*task, nullptr, std::make_exception_ptr(std::runtime_error("scheduler stopped")));
+    }
+}
+
+// Takes turns on the evaluations in queue i, stealing from the other
+// queues once it is empty.
+void Scheduler::work(size_t i) {
+    while (!stopping) {
+        std::unique_ptr<task_t> task = take(i);
+        if (task == nullptr) {
+            std::unique_lock<std::mutex> guard(lock);
+            work_cond.wait(guard, [this]() { return stopping || queued > 0; });
+        } else if (!advance(*task)) {
+            push(i, std::move(task));
+        }
+    }
+}
+
+// A thread takes the oldest task from its own queue, and steals the
+// newest from another, so the two rarely contend for the same task.
+std::unique_ptr<Scheduler::task_t> Scheduler::take(size_t i) {
+    for (size_t k = 0; k < queues.size(); k++) {
+        queue_t &queue = *queues[(i + k) % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+            continue;
+        std::unique_ptr<task_t> task;
+        if (k == 0) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        } else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        queued--;
+        return task;
+    }
+    return nullptr;
+}
+
+void Scheduler::push(size_t i, std::unique_ptr<task_t> task) {
+    std::lock_guard<std::mutex> guard(queues[i]->lock);
+    queues[i]->tasks.push_back(std::move(task));
+    queued++;
+}
+
+// Runs one turn of a task. Returns true if the task has finished.
+bool Scheduler::advance(task_t &task) {
+    PTR(Val) result = nullptr;
+    std::exception_ptr error = nullptr;
+    try {
+        long steps = (Step::max_steps > 0) ? std::min(slice, Step::max_steps - task.steps) : slice;
+        if (!task.step.run(steps)) {
+            task.steps += steps;
+            if (Step::max_steps > 0 && task.steps >= Step::max_steps)
+                throw std::runtime_error("step limit exceeded");
+            if (Step::time_limit.count() > 0 && std::chrono::steady_clock::now() - task.started >= Step::time_limit)
+                throw std::runtime_error("time limit exceeded");
+            return false;
+        }
+        result = task.step.val;
+    } catch (std::runtime_error) {
+        error = std::current_exception();
+    }
+    finish(task, result, error);
+    return true;
+}
+
+void Scheduler::finish(task_t &task, PTR(Val) result, std::exception_ptr error) {
+    task.done(result, error);
+    std::lock_guard<std::mutex> guard(lock);
+    if (--pending == 0)
+        idle_cond.notify_all();
+}
+
+/* for tests */
+static std::string sum_program(int n) {
+    return "_letrec sum = _fun (n) _if n == 0 _then 0 _else n + sum(n + -1) _in sum(" + std::to_string(n) + ")";
+}
+
+TEST_CASE("scheduler turns") {
+    // Without threads, wait() takes the turns, so the order is fixed.
+    Scheduler scheduler(0, 100);
+    std::vector<int64_t> finished;
+    for (int n : {3000, 2000, 10})
+        scheduler.submit(parse_str(sum_program(n)), [&finished](PTR(Val) val, std::exception_ptr error) {
+            finished.push_back(CAST(NumVal)(val)->rep);
+        });
+    scheduler.wait();
+    CHECK(finished == std::vector<int64_t>({55, 2001000, 4501500}));
+
+    std::future<PTR(Val)> failed = scheduler.submit(parse_str("1 + x"));
+    std::future<PTR(Val)> chained = scheduler.submit(parse_str("_let f = _fun (x) x * 2 _in f(21)"));
+    scheduler.wait();
+    CHECK_THROWS_WITH(failed.get(), "free variable: x");
+    CHECK(chained.get()->equals(NEW(NumVal)(42)));
+
+    Step::max_steps = 5000;
+    std::future<PTR(Val)> runaway = scheduler.submit(parse_str("_letrec loop = _fun (n) loop(n + 1) _in loop(0)"));
+    scheduler.wait();
+    Step::max_steps = 0;
+    CHECK_THROWS_WITH(runaway.get(), "step limit exceeded");
+
+    std::future<PTR(Val)> unfinished = scheduler.submit(parse_str(sum_program(10)));
+    scheduler.stop();
+    CHECK_THROWS_WITH(unfinished.get(), "scheduler stopped");
+    CHECK_THROWS_WITH(scheduler.submit(parse_str("1")).get(), "scheduler stopped");
+}
+
+TEST_CASE("scheduler threads") {
+    if (!values_are_thread_safe)
+        return;
+    Scheduler scheduler(4, 50);
+    std::vector<std::future<PTR(Val)>> results;
+    for (int i = 0; i < 200; i++)
+        results.push_back(scheduler.submit(parse_str(sum_program(i))));
+    // A runaway evaluation only takes turns, so the others still finish.
+    std::future<PTR(Val)> runaway = scheduler.submit(parse_str("_letrec loop = _fun (n) loop(n + 1) _in loop(0)"));
+    for (int i = 0; i < 200; i++)
+        CHECK(CAST(NumVal)(results[i].get())->rep == i * (i + 1) / 2);
+
+    scheduler.stop();
+    CHECK_THROWS_WITH(runaway.get(), "scheduler stopped");
+}
@@ -0,0 +1,112 @@
+//
+// Runs many step-mode evaluations at once by taking turns on a few threads.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pointer.hpp"
+#include "Expr.hpp"
+#include "Step.hpp"
+
+/**
+ * A <code>Scheduler</code> holds any number of unfinished evaluations, each a suspended Step machine, and runs them
+ * in turns of a fixed number of steps on a small pool of threads. A long evaluation only delays the others by one
+ * turn at a time.
+ * Every thread takes turns from its own queue, and a thread whose queue is empty steals evaluations from the others.
+ * Evaluations are stopped with an error once <code>Step::max_steps</code> or <code>Step::time_limit</code> is
+ * exceeded, as they are by <code>Step::interp_by_steps</code>.
+ * In builds whose reference counts are not atomic, a Scheduler has no threads and runs evaluations in
+ * <code>wait</code>.
+ */
+class Scheduler {
+public:
+    /**
+     * Receives an evaluation's result, or the error that ended it. Runs on one of the Scheduler's threads.
+     */
+    typedef std::function<void(PTR(Val) result, std::exception_ptr error)> callback_t;
+
+    /**
+     * Starts the threads.
+     * @param threads number of threads, or 0 to run evaluations only in <code>wait</code>.
+     * @param slice most steps an evaluation takes per turn.
+     */
+    Scheduler(int threads, long slice = 1000);
+
+    /**
+     * Stops the Scheduler as <code>stop</code> does.
+     */
+    ~Scheduler();
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    /**
+     * Starts evaluating an Expr.
+     * @param e Expr to evaluate.
+     * @param done called once with the result or error.
+     */
+    void submit(PTR(Expr) e, callback_t done);
+
+    /**
+     * Starts evaluating an Expr.
+     * @param e Expr to evaluate.
+     * @return future result, which throws the evaluation's error instead if there was one.
+     */
+    std::future<PTR(Val)> submit(PTR(Expr) e);
+
+    /**
+     * Waits until every evaluation submitted so far, and every one submitted by their callbacks, has finished.
+     */
+    void wait();
+
+    /**
+     * Stops the threads. Unfinished evaluations, and any submitted later, end with a "scheduler stopped" error.
+     */
+    void stop();
+
+private:
+    struct task_t {
+        Step step;
+        callback_t done;
+        long steps;
+        std::chrono::steady_clock::time_point started;
+
+        task_t(PTR(Expr) e, callback_t done);
+    };
+
+    struct queue_t {
+        std::mutex lock;
+        std::deque<std::unique_ptr<task_t>> tasks;
+    };
+
+    long slice;
+    std::vector<std::unique_ptr<queue_t>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_queue;
+    // Tasks in the queues, not counting those being run.
+    std::atomic<long> queued;
+
+    std::mutex lock;
+    std::condition_variable work_cond;
+    std::condition_variable idle_cond;
+    // Tasks submitted and not yet finished.
+    long pending;
+    std::atomic<bool> stopping;
+
+    void work(size_t i);
+    std::unique_ptr<task_t> take(size_t i);
+    void push(size_t i, std::unique_ptr<task_t> task);
+    bool advance(task_t &task);
+    void finish(task_t &task, PTR(Val) result, std::exception_ptr error);
+};
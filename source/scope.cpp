@@ -0,0 +1,103 @@
+//
+// Lexical scopes used to resolve variables to frame slots.
+//
+
+#include "scope.hpp"
+#include "parser.hpp"
+#include "catch.hpp"
+
+Scope::Scope(Scope *enclosing) {
+    this->enclosing = enclosing;
+    this->frame_size = 0;
+}
+
+int Scope::bind(const Symbol &name) {
+    bindings.push_back(std::make_pair(name, frame_size));
+    return frame_size++;
+}
+
+void Scope::unbind() {
+    bindings.pop_back();
+}
+
+bool Scope::find(const Symbol &name, int &depth, int &slot) {
+    depth = 0;
+    for (Scope *s = this; s != nullptr; s = s->enclosing, depth++) {
+        for (size_t i = s->bindings.size(); i > 0; i--) {
+            if (s->bindings[i - 1].first == name) {
+                slot = s->bindings[i - 1].second;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+Resolver::Resolver(Scope &scope) {
+    this->scope = &scope;
+}
+
+PTR(Expr) Resolver::run(PTR(Expr) e) {
+    visit(e);
+    while (!frames.empty()) {
+        // The frame keeps the node alive, even if the node pushes more
+        // frames and the vector moves it.
+        Expr *expr = &*frames.back().expr;
+        int stage = frames.back().stage++;
+        if (expr->resolve_step(*this, stage))
+            frames.pop_back();
+    }
+    return take();
+}
+
+void Resolver::visit(PTR(Expr) e) {
+    frames.push_back({std::move(e), 0});
+}
+
+PTR(Expr) Resolver::take() {
+    PTR(Expr) e = std::move(results.back());
+    results.pop_back();
+    return e;
+}
+
+void Resolver::give(PTR(Expr) e) {
+    results.push_back(std::move(e));
+}
+
+void Resolver::enter() {
+    bodies.push_back(std::make_unique<Scope>(scope));
+    scope = bodies.back().get();
+}
+
+int Resolver::leave() {
+    int frame_size = scope->frame_size;
+    scope = scope->enclosing;
+    bodies.pop_back();
+    return frame_size;
+}
+
+PTR(Val) interp_resolved(PTR(Expr) e) {
+    Scope scope(nullptr);
+    PTR(Expr) resolved = e->resolve(scope);
+    return resolved->interp(NEW(FrameEnv)(Env::empty, scope.frame_size));
+}
+
+TEST_CASE("resolve") {
+    Scope scope(nullptr);
+    PTR(Expr) e = parse_str("_let x = 1 _in _let f = _fun (y) x + y _in f(x)")->resolve(scope);
+    CHECK(scope.frame_size == 2);
+    CHECK(scope.bindings.empty());
+
+    PTR(LetExpr) let_x = CAST(LetExpr)(e);
+    PTR(LetExpr) let_f = CAST(LetExpr)(let_x->in_expr);
+    PTR(FunExpr) fun = CAST(FunExpr)(let_f->var_val);
+    PTR(AddExpr) body = CAST(AddExpr)(fun->actual_arg);
+    CHECK(let_x->slot == 0);
+    CHECK(let_f->slot == 1);
+    CHECK(fun->frame_size == 1);
+    CHECK(CAST(VarExpr)(body->lhs)->depth == 1);
+    CHECK(CAST(VarExpr)(body->lhs)->slot == 0);
+    CHECK(CAST(VarExpr)(body->rhs)->depth == 0);
+    CHECK(CAST(VarExpr)(body->rhs)->slot == 0);
+    CHECK(e->equals(parse_str("_let x = 1 _in _let f = _fun (y) x + y _in f(x)")));
+}
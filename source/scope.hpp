@@ -0,0 +1,122 @@
+//
+// Lexical scopes used to resolve variables to frame slots.
+//
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "pointer.hpp"
+#include "Expr.hpp"
+
+/**
+ * A <code>Scope</code> tracks the variables bound so far in one function body, or in the top level of a
+ * program, while <code>Expr::resolve</code> walks it. Each binder gets its own slot in the frame, so a slot is
+ * written at most once per call and closures can keep a reference to the frame.
+ */
+class Scope {
+public:
+    Scope *enclosing;
+    std::vector<std::pair<Symbol, int>> bindings;
+    int frame_size;
+
+    /**
+     * Constructs an empty Scope.
+     * @param enclosing Scope of the function this one is nested in, or nullptr for the top level.
+     */
+    Scope(Scope *enclosing);
+
+    /**
+     * Gives a name the next free slot, shadowing any earlier binding of the same name.
+     * @param name variable being bound.
+     * @return slot the variable's value is stored in.
+     */
+    int bind(const Symbol &name);
+
+    /**
+     * Removes the most recent binding.
+     */
+    void unbind();
+
+    /**
+     * Finds the innermost binding of a name.
+     * @param name variable to find.
+     * @param depth set to the number of frames out the variable is bound.
+     * @param slot set to the slot the variable is stored in.
+     * @return true if the variable is bound, false if it is free.
+     */
+    bool find(const Symbol &name, int &depth, int &slot);
+};
+
+/**
+ * A <code>Resolver</code> walks an Expr for <code>Expr::resolve</code>, keeping the nodes it is part way through
+ * on its own stack. Each node's <code>resolve_step</code> is called once per stage, starting from 0, until it
+ * returns true. At each stage a node either visits one of its children, whose resolved Expr is then left on
+ * <code>results</code>, or takes its resolved children off <code>results</code> and gives its own resolved Expr.
+ */
+class Resolver {
+public:
+    /* Scope of the innermost function body being resolved. */
+    Scope *scope;
+    std::vector<PTR(Expr)> results;
+
+    /**
+     * Constructs a Resolver for the top level of an Expr.
+     * @param scope Scope the Expr is in.
+     */
+    Resolver(Scope &scope);
+
+    /**
+     * Resolves an Expr by calling the <code>resolve_step</code> of each node until all are done.
+     * @param e Expr to resolve.
+     * @return resolved Expr.
+     */
+    PTR(Expr) run(PTR(Expr) e);
+
+    /**
+     * Resolves a child before the node that visits it takes its next stage.
+     * @param e child to resolve.
+     */
+    void visit(PTR(Expr) e);
+
+    /**
+     * @return the most recent resolved Expr, removed from <code>results</code>.
+     */
+    PTR(Expr) take();
+
+    /**
+     * Finishes a node.
+     * @param e resolved node.
+     */
+    void give(PTR(Expr) e);
+
+    /**
+     * Starts the Scope of a function body nested in the current one.
+     */
+    void enter();
+
+    /**
+     * Ends the Scope of a function body, returning to the enclosing one.
+     * @return number of slots the body's frame needs.
+     */
+    int leave();
+
+private:
+    typedef struct {
+        PTR(Expr) expr;
+        int stage;
+    } frame_t;
+
+    std::vector<frame_t> frames;
+    std::vector<std::unique_ptr<Scope>> bodies;
+};
+
+/**
+ * Resolves an Expr's variables to frame slots and then evaluates it.
+ * Produces the same result as <code>interp(Env::empty)</code>, without comparing variable names.
+ * /exception If the evaluation reaches a free variable, an error will be thrown.
+ * @param e Expr to be evaluated.
+ * @return Val representing the Expr solution or a semantically equivalent value.
+ */
+PTR(Val) interp_resolved(PTR(Expr) e);
@@ -0,0 +1,374 @@
+//
+// Long-lived server that runs MSDscript programs sent over a Unix domain socket.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.hpp"
+#include "parser.hpp"
+#include "arena.hpp"
+#include "catch.hpp"
+
+// Requests longer than this are refused, and their connection closed.
+static const uint32_t max_request = 64 * 1024 * 1024;
+
+static bool read_fully(int fd, void *buffer, size_t size) {
+    char *p = (char *) buffer;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_fully(int fd, const void *buffer, size_t size) {
+    const char *p = (const char *) buffer;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void put_length(unsigned char *p, uint32_t length) {
+    p[0] = length >> 24;
+    p[1] = length >> 16;
+    p[2] = length >> 8;
+    p[3] = length;
+}
+
+static uint32_t get_length(const unsigned char *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static sockaddr_un socket_address(const std::string &path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("socket path too long: " + path);
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+Server::Server(const std::string &path, run_mode_t mode, int workers) {
+    // Interp results are the same by steps, which cannot overflow the stack.
+    if (mode != interp_mode && mode != step_mode)
+        throw std::runtime_error("--serve runs programs by steps, so only --step or the default mode can be served");
+    this->path = path;
+    this->workers = std::max(workers, 1);
+    this->stopping = false;
+    if (values_are_thread_safe)
+        scheduler = std::make_unique<Scheduler>(this->workers);
+    else
+        this->workers = 1;
+
+    sockaddr_un address = socket_address(path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw std::runtime_error("cannot create socket " + path);
+    unlink(path.c_str());
+    if (bind(listen_fd, (sockaddr *) &address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+        close(listen_fd);
+        throw std::runtime_error("cannot listen on " + path);
+    }
+    if (pipe(wake_fds) < 0) {
+        close(listen_fd);
+        unlink(path.c_str());
+        throw std::runtime_error("cannot create socket " + path);
+    }
+}
+
+Server::~Server() {
+    close(listen_fd);
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    unlink(path.c_str());
+}
+
+// Waits for requests on every idle connection at once. A connection
+// with a request is handed to a worker, which gives it back once it
+// has written the response.
+void Server::run() {
+    // A client that hangs up early must not end the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++)
+        threads.push_back(std::thread([this]() { work(); }));
+
+    std::vector<int> idle;
+    std::vector<pollfd> polled;
+    while (1) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping)
+                break;
+            idle.insert(idle.end(), answered.begin(), answered.end());
+            answered.clear();
+        }
+
+        polled.clear();
+        polled.push_back({wake_fds[0], POLLIN, 0});
+        polled.push_back({listen_fd, POLLIN, 0});
+        for (int fd : idle)
+            polled.push_back({fd, POLLIN, 0});
+        if (poll(polled.data(), polled.size(), -1) < 0)
+            continue;
+
+        if (polled[0].revents) {
+            char drained[64];
+            (void) read(wake_fds[0], drained, sizeof(drained));
+        }
+        idle.clear();
+        for (size_t i = 2; i < polled.size(); i++) {
+            if (polled[i].revents) {
+                std::lock_guard<std::mutex> guard(lock);
+                ready.push_back(polled[i].fd);
+                ready_cond.notify_one();
+            } else {
+                idle.push_back(polled[i].fd);
+            }
+        }
+        if (polled[1].revents & POLLIN) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0)
+                idle.push_back(fd);
+        }
+    }
+
+    ready_cond.notify_all();
+    for (std::thread &t : threads)
+        t.join();
+    // Programs still running are answered with an error.
+    if (scheduler != nullptr)
+        scheduler->stop();
+    for (int fd : idle)
+        close(fd);
+    for (int fd : ready)
+        close(fd);
+    for (int fd : answered)
+        close(fd);
+    ready.clear();
+    answered.clear();
+}
+
+void Server::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready_cond.notify_all();
+    wake();
+}
+
+void Server::wake() {
+    char c = 0;
+    (void) write(wake_fds[1], &c, 1);
+}
+
+void Server::work() {
+    while (1) {
+        int fd;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready_cond.wait(guard, [this]() { return stopping || !ready.empty(); });
+            if (stopping)
+                return;
+            fd = ready.front();
+            ready.pop_front();
+        }
+
+        answer(fd);
+    }
+}
+
+// Reads one request from a connection and responds to it, now or once
+// the Scheduler has run it, then releases the connection.
+void Server::answer(int fd) {
+    unsigned char header[4];
+    if (!read_fully(fd, header, 4)) {
+        release(fd, false);
+        return;
+    }
+    uint32_t length = get_length(header);
+    std::string program(std::min(length, max_request), '\0');
+    if (length > max_request || !read_fully(fd, &program[0], length)) {
+        release(fd, false);
+        return;
+    }
+
+    try {
+        PTR(Expr) e = parse(program, NEW(Arena)());
+        if (scheduler != nullptr) {
+            scheduler->submit(e, [this, fd](PTR(Val) val, std::exception_ptr error) {
+                try {
+                    if (error)
+                        std::rethrow_exception(error);
+                    release(fd, respond(fd, false, val->to_string()));
+                } catch (const std::runtime_error &error) {
+                    release(fd, respond(fd, true, error.what()));
+                }
+            });
+            return;
+        }
+        release(fd, respond(fd, false, Step::interp_by_steps(e)->to_string()));
+    } catch (const std::runtime_error &error) {
+        release(fd, respond(fd, true, error.what()));
+    }
+}
+
+// Writes a response. Returns false if the connection is broken.
+bool Server::respond(int fd, bool failed, const std::string &text) {
+    unsigned char header[5];
+    header[0] = failed ? 1 : 0;
+    put_length(header + 1, (uint32_t) text.size());
+    return write_fully(fd, header, 5) && write_fully(fd, text.data(), text.size());
+}
+
+// Gives an answered connection back to run() to wait on, or closes it.
+void Server::release(int fd, bool open) {
+    if (!open) {
+        close(fd);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        answered.push_back(fd);
+    }
+    wake();
+}
+
+Client::Client(const std::string &path) {
+    sockaddr_un address = socket_address(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error("cannot create socket");
+    if (connect(fd, (sockaddr *) &address, sizeof(address)) < 0) {
+        close(fd);
+        throw std::runtime_error("cannot connect to " + path);
+    }
+}
+
+Client::~Client() {
+    close(fd);
+}
+
+std::string Client::run(std::string_view program, bool &failed) {
+    unsigned char header[5];
+    put_length(header, (uint32_t) program.size());
+    if (!write_fully(fd, header, 4) || !write_fully(fd, program.data(), program.size()))
+        throw std::runtime_error("lost connection to server");
+
+    if (!read_fully(fd, header, 5))
+        throw std::runtime_error("lost connection to server");
+    failed = (header[0] != 0);
+    std::string text(get_length(header + 1), '\0');
+    if (!read_fully(fd, &text[0], text.size()))
+        throw std::runtime_error("lost connection to server");
+    return text;
+}
+
+// The tests are left out of builds without tests.
+#ifndef CATCH_CONFIG_DISABLE
+
+TEST_CASE("server") {
+    std::string path = "/tmp/msdscript_test_" + std::to_string(getpid()) + ".sock";
+    Server server(path, interp_mode, 2);
+    std::thread serving([&server]() { server.run(); });
+
+    bool failed;
+    Client first(path);
+    CHECK(first.run("1 + 2", failed) == "3");
+    CHECK(!failed);
+    CHECK(first.run("1 + x", failed) == "free variable: x");
+    CHECK(failed);
+    CHECK(first.run("_let", failed) == "expected =");
+    CHECK(failed);
+    CHECK(first.run("", failed) == "expected a digit or open parenthesis at \xff");
+
+    // Connections are served concurrently and each gets its own results.
+    std::vector<std::string> results(4);
+    std::vector<std::thread> clients;
+    for (int i = 0; i < 4; i++)
+        clients.push_back(std::thread([&, i]() {
+            Client client(path);
+            bool client_failed;
+            for (int j = 0; j < 50; j++)
+                results[i] += client.run("_letrec f = _fun (n) _if n == 0 _then 0 _else n + f(n + -1) _in f("
+                                         + std::to_string(i * 10) + ")", client_failed) + " ";
+        }));
+    for (std::thread &t : clients)
+        t.join();
+    CHECK(results[0].substr(0, 4) == "0 0 ");
+    CHECK(results[3].substr(0, 8) == "465 465 ");
+    CHECK(results[3].size() == 50 * 4);
+    CHECK(first.run("_fun (x) x", failed) == "[function]");
+
+    // A program that recurses without end runs out of steps instead of
+    // overflowing the stack, and the server carries on.
+    Step::max_steps = 100000;
+    CHECK(first.run("_letrec f = _fun (n) f(n + 1) + 1 _in f(0)", failed) == "step limit exceeded");
+    CHECK(failed);
+    Step::max_steps = 0;
+    CHECK(first.run("1 + 2", failed) == "3");
+    CHECK_THROWS_WITH(Server(path + ".vm", vm_mode, 1),
+                      "--serve runs programs by steps, so only --step or the default mode can be served");
+
+    server.stop();
+    serving.join();
+    CHECK_THROWS_WITH(first.run("1", failed), "lost connection to server");
+}
+
+TEST_CASE("server in step mode") {
+    if (!values_are_thread_safe)
+        return;
+    std::string path = "/tmp/msdscript_test_step_" + std::to_string(getpid()) + ".sock";
+    Server server(path, step_mode, 1);
+    std::thread serving([&server]() { server.run(); });
+
+    // A program that never finishes takes turns with the others instead
+    // of holding up the only worker.
+    std::string runaway_result;
+    bool runaway_failed = false;
+    std::thread runaway([&]() {
+        try {
+            Client client(path);
+            runaway_result = client.run("_letrec loop = _fun (n) loop(n + 1) _in loop(0)", runaway_failed);
+        } catch (const std::runtime_error &error) {
+            runaway_result = error.what();
+        }
+    });
+    bool failed;
+    Client client(path);
+    for (int i = 0; i < 20; i++)
+        CHECK(client.run("_letrec f = _fun (n) _if n == 0 _then 0 _else n + f(n + -1) _in f(100)", failed) == "5050");
+    CHECK(client.run("_true + 1", failed) == "no adding booleans");
+    CHECK(failed);
+
+    server.stop();
+    serving.join();
+    runaway.join();
+    CHECK(runaway_result == "scheduler stopped");
+    CHECK(runaway_failed);
+}
+
+#endif
@@ -0,0 +1,108 @@
+//
+// Long-lived server that runs MSDscript programs sent over a Unix domain socket.
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "driver.hpp"
+#include "scheduler.hpp"
+
+/**
+ * A <code>Server</code> listens on a Unix domain socket and runs each program it is sent, so callers pay for
+ * starting a process once instead of once per program.
+ * Every request is a 4-byte big-endian length followed by that many bytes of program text. Every response is a
+ * status byte, 0 for a result or 1 for an error message, then a 4-byte big-endian length and the text.
+ * A connection can send any number of requests, and gets its responses in the same order. Connections are
+ * served concurrently by a pool of worker threads, while one thread waits for requests on all idle connections.
+ * Programs are evaluated by steps, in <code>interp_mode</code> as well as <code>step_mode</code>, so a program that
+ * recurses deeply fails with an error instead of overflowing the C++ stack and ending the server. The modes that
+ * recurse on the C++ stack cannot be served. The programs take turns on a Scheduler, so a program that runs for a
+ * long time does not hold up the others, and Step::max_steps and Step::time_limit limit each program.
+ */
+class Server {
+public:
+    /* Step::max_steps used by <code>--serve</code> if no other limit is given. */
+    static const long default_max_steps = 10000000;
+
+    /**
+     * Creates the socket and starts listening on it. A file already at the path is replaced.
+     * /exception If the socket cannot be created, or the mode cannot be served, an error will be thrown.
+     * @param path path of the socket.
+     * @param mode how to run each program, <code>interp_mode</code> or <code>step_mode</code>.
+     * @param workers number of programs to run at once.
+     */
+    Server(const std::string &path, run_mode_t mode, int workers);
+    ~Server();
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    /**
+     * Serves requests on the calling thread until <code>stop</code> is called.
+     */
+    void run();
+
+    /**
+     * Makes <code>run</code> return once the programs being run have finished. Can be called from any thread.
+     */
+    void stop();
+
+private:
+    std::string path;
+    int workers;
+    int listen_fd;
+    // Written to wake the thread waiting in run().
+    int wake_fds[2];
+
+    std::mutex lock;
+    std::condition_variable ready_cond;
+    // Connections with a request waiting, for the workers to take.
+    std::deque<int> ready;
+    // Connections a worker has answered, to wait on again.
+    std::vector<int> answered;
+    bool stopping;
+    std::unique_ptr<Scheduler> scheduler;
+
+    void work();
+    void answer(int fd);
+    bool respond(int fd, bool failed, const std::string &text);
+    void release(int fd, bool open);
+    void wake();
+};
+
+/**
+ * A <code>Client</code> is one connection to a Server.
+ */
+class Client {
+public:
+    /**
+     * Connects to a Server.
+     * /exception If the connection fails, an error will be thrown.
+     * @param path path of the Server's socket.
+     */
+    Client(const std::string &path);
+    ~Client();
+
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    /**
+     * Sends a program and waits for its response.
+     * /exception If the connection is lost, an error will be thrown.
+     * @param program text of the program.
+     * @param failed set to true if the response is an error message, false if it is a result.
+     * @return result or error message.
+     */
+    std::string run(std::string_view program, bool &failed);
+
+private:
+    int fd;
+};
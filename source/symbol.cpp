@@ -0,0 +1,152 @@
+//
+// Interned names for variables and formal arguments.
+//
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "symbol.hpp"
+#include "catch.hpp"
+
+// The table is first swept when it reaches this many names.
+static const size_t min_sweep = 4096;
+
+typedef struct {
+    std::mutex lock;
+    std::unordered_map<std::string, Symbol::info_t> names;
+    // Ids of swept names, to give out again before new ones.
+    std::vector<unsigned> free_ids;
+    unsigned next_id = 1;
+    size_t sweep_at = min_sweep;
+} symbol_table_t;
+
+// A name is only swept when two sweeps in a row find it unheld, with no
+// interning of it in between, so a Symbol that was just made has until
+// the next sweep to be held.
+static void sweep_table(symbol_table_t &table) {
+    for (auto i = table.names.begin(); i != table.names.end();) {
+        Symbol::info_t &info = i->second;
+        if (info.holders.load(std::memory_order_acquire) != 0) {
+            info.idle = false;
+            ++i;
+        } else if (!info.idle) {
+            info.idle = true;
+            ++i;
+        } else {
+            table.free_ids.push_back(info.id);
+            i = table.names.erase(i);
+        }
+    }
+    table.sweep_at = std::max(min_sweep, 2 * table.names.size());
+}
+
+// The table is never destroyed, so Symbols held by other static
+// objects stay valid while the process exits.
+static symbol_table_t &symbol_table() {
+    static symbol_table_t *table = new symbol_table_t;
+    return *table;
+}
+
+Symbol::Symbol(const std::string &name) {
+    this->id = 0;
+    this->entry = nullptr;
+    if (name.empty())
+        return;
+    symbol_table_t &table = symbol_table();
+    std::lock_guard<std::mutex> guard(table.lock);
+    auto found = table.names.find(name);
+    if (found == table.names.end()) {
+        if (table.names.size() >= table.sweep_at)
+            sweep_table(table);
+        found = table.names.try_emplace(name).first;
+        if (table.free_ids.empty()) {
+            found->second.id = table.next_id++;
+        } else {
+            found->second.id = table.free_ids.back();
+            table.free_ids.pop_back();
+        }
+        found->second.holders.store(0, std::memory_order_relaxed);
+    }
+    found->second.idle = false;
+    // Elements of an unordered_map never move, so the pointer stays valid.
+    this->entry = &*found;
+    this->id = entry->second.id;
+}
+
+Symbol::Symbol(const char *name) : Symbol(std::string(name)) {
+}
+
+void Symbol::sweep() {
+    symbol_table_t &table = symbol_table();
+    std::lock_guard<std::mutex> guard(table.lock);
+    sweep_table(table);
+}
+
+size_t Symbol::interned() {
+    symbol_table_t &table = symbol_table();
+    std::lock_guard<std::mutex> guard(table.lock);
+    return table.names.size();
+}
+
+// The tests are left out of builds without tests.
+#ifndef CATCH_CONFIG_DISABLE
+
+TEST_CASE("symbol") {
+    Symbol x = "x";
+    Symbol y = std::string("y");
+
+    CHECK(x == Symbol("x"));
+    CHECK(x != y);
+    CHECK(&x.str() == &Symbol(std::string("x")).str());
+    CHECK(y.str() == "y");
+    CHECK(Symbol("") == Symbol());
+    CHECK(std::hash<Symbol>()(x) == std::hash<Symbol>()(Symbol("x")));
+
+    // Names interned at the same time on different threads agree.
+    std::vector<Symbol> seen(4);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+        threads.push_back(std::thread([&seen, i]() {
+            for (int j = 0; j < 1000; j++)
+                Symbol("sym" + std::to_string(j));
+            seen[i] = Symbol("sym999");
+        }));
+    for (std::thread &t : threads)
+        t.join();
+    for (int i = 0; i < 4; i++)
+        CHECK(seen[i] == Symbol("sym999"));
+
+    // Names that nothing holds are swept at the second sweep that finds them unheld, and the others kept.
+    CHECK(!(x < x));
+    CHECK((x < y) != (y < x));
+    Symbol::sweep();
+    Symbol::sweep();
+    size_t before = Symbol::interned();
+    Symbol kept("keptname");
+    kept.hold();
+    {
+        Symbol unused("unusedname");
+        Symbol copy = unused;
+        Symbol::sweep();
+        CHECK(Symbol::interned() == before + 2);
+        // Interning a name again keeps it through the next sweep.
+        CHECK(copy == Symbol("unusedname"));
+    }
+    Symbol::sweep();
+    CHECK(Symbol::interned() == before + 2);
+    Symbol::sweep();
+    CHECK(Symbol::interned() == before + 1);
+
+    // The table sweeps itself as it grows.
+    for (int i = 0; i < 100000; i++)
+        Symbol("name" + std::to_string(i));
+    CHECK(Symbol::interned() < 10000);
+    CHECK(&kept.str() == &Symbol("keptname").str());
+    CHECK(kept == Symbol("keptname"));
+    CHECK(kept.str() == "keptname");
+    kept.drop();
+}
+
+#endif
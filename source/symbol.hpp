@@ -0,0 +1,119 @@
+//
+// Interned names for variables and formal arguments.
+//
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * A <code>Symbol</code> is a name interned in a table shared by the whole process. Each interned name has a small
+ * integer id, so Symbols are compared, ordered and hashed by id, and copying one copies two words.
+ * A Symbol can be made from any string, which interns it. Copies are not counted. Instead, the Exprs and Vals
+ * that name variables <code>hold</code> their names, and so does a parser until it is done. Names that nothing
+ * holds through a whole sweep interval are swept once the table has doubled in size, so a long-running process
+ * does not keep every name it has seen.
+ */
+class Symbol {
+public:
+    /* What the table knows about an interned name. */
+    typedef struct {
+        unsigned id;
+        std::atomic<long> holders;
+        // Whether the last sweep found no holders. Only changed with the table locked.
+        bool idle;
+    } info_t;
+    typedef std::pair<const std::string, info_t> entry_t;
+
+    /**
+     * Constructs the Symbol for the empty name.
+     */
+    Symbol() : id(0), entry(nullptr) {
+    }
+
+    /**
+     * Interns a name.
+     * @param name name to intern.
+     */
+    Symbol(const std::string &name);
+    Symbol(const char *name);
+
+    /**
+     * Returns the interned name, which lives as long as the name is held.
+     * @return name of the Symbol.
+     */
+    const std::string &str() const {
+        return (entry != nullptr) ? entry->first : empty_name();
+    }
+
+    /**
+     * Keeps the name interned until the matching <code>drop</code>.
+     */
+    void hold() const {
+        if (entry != nullptr)
+            entry->second.holders.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Undoes one <code>hold</code>.
+     */
+    void drop() const {
+        if (entry != nullptr)
+            entry->second.holders.fetch_sub(1, std::memory_order_release);
+    }
+
+    /**
+     * Counts the names in the table, including those not yet swept.
+     * @return number of distinct names in the table.
+     */
+    static size_t interned();
+
+    /**
+     * Removes every name that was not held at this sweep or the one before from the table. Interning does this by
+     * itself as the table grows.
+     */
+    static void sweep();
+
+    bool operator==(const Symbol &other) const {
+        return id == other.id;
+    }
+
+    bool operator!=(const Symbol &other) const {
+        return id != other.id;
+    }
+
+    /* An arbitrary but consistent order, for keeping Symbols sorted. */
+    bool operator<(const Symbol &other) const {
+        return id < other.id;
+    }
+
+private:
+    // The empty name is not in the table, and is the only name with
+    // id 0 and no entry.
+    unsigned id;
+    entry_t *entry;
+
+    static const std::string &empty_name() {
+        static const std::string empty;
+        return empty;
+    }
+
+    friend struct std::hash<Symbol>;
+};
+
+/* A list of variables, shared by everything that refers to it. */
+typedef std::shared_ptr<const std::vector<Symbol>> var_list_t;
+
+namespace std {
+    template <>
+    struct hash<Symbol> {
+        size_t operator()(const Symbol &s) const {
+            return hash<unsigned>()(s.id);
+        }
+    };
+}
@@ -0,0 +1,119 @@
+//
+// Releases long chains of Envs, Vals and Exprs without deep recursion.
+//
+
+#include <vector>
+#include "teardown.hpp"
+#include "Expr.hpp"
+#include "env.hpp"
+#include "value.hpp"
+#include "catch.hpp"
+
+typedef struct {
+    std::vector<PTR(Env)> envs;
+    std::vector<PTR(Val)> vals;
+    std::vector<PTR(Expr)> exprs;
+} pending_t;
+
+// Releases nested up to this depth just free their object directly,
+// which is the common case and costs nothing extra. Deeper ones are
+// queued for the release at the limit, which frees them one by one.
+static const int max_nesting = 256;
+
+static thread_local int nesting = 0;
+
+// Objects waiting to be freed by the release at the nesting limit.
+// The lists live on that release's stack frame, so nothing here needs
+// to be destroyed when the thread exits.
+static thread_local pending_t *active = nullptr;
+
+template <typename T>
+static bool pop_one(std::vector<PTR(T)> &list) {
+    if (list.empty())
+        return false;
+    // Move the pointer out before freeing it, since its destructor may
+    // push more objects onto the same list.
+    PTR(T) last = std::move(list.back());
+    list.pop_back();
+    return true;
+}
+
+template <typename T>
+static void release_ptr(PTR(T) &p, std::vector<PTR(T)> pending_t::*list) {
+    if (nesting < max_nesting) {
+        nesting++;
+        p = nullptr;
+        nesting--;
+        return;
+    }
+    if (p == nullptr || p.use_count() != 1) {
+        p = nullptr;
+        return;
+    }
+    if (active != nullptr) {
+        (active->*list).push_back(std::move(p));
+        p = nullptr;
+        return;
+    }
+
+    pending_t pending;
+    active = &pending;
+    p = nullptr;
+    while (pop_one(pending.envs) || pop_one(pending.vals) || pop_one(pending.exprs))
+        ;
+    active = nullptr;
+}
+
+void Teardown::release(PTR(Env) &p) {
+    release_ptr(p, &pending_t::envs);
+}
+
+void Teardown::release(PTR(Val) &p) {
+    release_ptr(p, &pending_t::vals);
+}
+
+void Teardown::release(PTR(Expr) &p) {
+    release_ptr(p, &pending_t::exprs);
+}
+
+TEST_CASE("teardown") {
+    const int depth = 1000000;
+
+    SECTION("env chain") {
+        PTR(Env) env = Env::empty;
+        for (int i = 0; i < depth; i++)
+            env = NEW(ExtendedEnv)(env, "x", NumVal::make(i));
+        CHECK(env->lookup("x")->equals(NumVal::make(depth - 1)));
+        env = nullptr;
+    }
+
+    SECTION("frames holding closures over the previous frame") {
+        PTR(Expr) body = NEW(VarExpr)("y", 0, 0);
+        PTR(Env) env = Env::empty;
+        for (int i = 0; i < depth; i++) {
+            PTR(Env) frame = NEW(FrameEnv)(env, 1);
+            frame->bind(0, NEW(FunVal)("y", body, env, 1));
+            env = frame;
+        }
+        CHECK(env->lookup(0, 0)->call(NumVal::make(7))->equals(NumVal::make(7)));
+        env = nullptr;
+    }
+
+    SECTION("right nested expression") {
+        PTR(Expr) e = NEW(NumExpr)(0);
+        for (int i = 0; i < depth; i++)
+            e = NEW(AddExpr)(NEW(NumExpr)(1), e);
+        PTR(Expr) shared = e;
+        e = nullptr;
+        CHECK(CAST(AddExpr)(shared)->lhs->equals(NEW(NumExpr)(1)));
+        shared = nullptr;
+    }
+
+    SECTION("mixed chain of lets and calls") {
+        PTR(Expr) e = NEW(NumExpr)(0);
+        for (int i = 0; i < depth; i++)
+            e = NEW(LetExpr)("x", NEW(CallExpr)(NEW(FunExpr)("y", e), NEW(NumExpr)(i)), NEW(IfExpr)(
+                    NEW(BoolExpr)(true), NEW(EqualExpr)(NEW(VarExpr)("x"), NEW(NumExpr)(1)), NEW(MultExpr)(e, e)));
+        e = nullptr;
+    }
+}
@@ -0,0 +1,29 @@
+//
+// Releases long chains of Envs, Vals and Exprs without deep recursion.
+//
+
+#pragma once
+
+#include "pointer.hpp"
+
+class Env;
+class Val;
+class Expr;
+
+/**
+ * The <code>Teardown</code> class lets destructors drop their children without recursing once per link.
+ * Destructors hand each child to <code>release</code>. Short chains are freed by ordinary nested destructor
+ * calls, and once a chain gets deep the rest of it is queued and freed one object at a time, so tearing down a
+ * chain of any length uses a bounded amount of C++ stack.
+ */
+class Teardown {
+public:
+    /**
+     * Drops a reference. If it was the last one, the object is freed now, or later by an enclosing
+     * release when destructors are already nested deeply.
+     * @param p pointer to drop. It is null afterwards.
+     */
+    static void release(PTR(Env) &p);
+    static void release(PTR(Val) &p);
+    static void release(PTR(Expr) &p);
+};
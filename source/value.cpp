@@ -6,35 +6,85 @@
 
 #include "Expr.hpp"
 #include <stdexcept>
+#include <vector>
 #include "catch.hpp"
+#include "teardown.hpp"
 #include "Step.hpp"
+#include "memo.hpp"
+#include "parser.hpp"
 
-NumVal::NumVal(int rep) {
+// Ints in [small_min, small_max) share preallocated NumVals.
+static const int small_min = -256;
+static const int small_max = 1024;
+
+PTR(Val) Val::call_with(std::vector<PTR(Val)> actual_args) {
+    return call(actual_args[0]);
+}
+
+void Val::call_step_with(std::vector<PTR(Val)> actual_arg_vals, Step &step) {
+    call_step(actual_arg_vals[0], step);
+}
+
+bool NumVal::promote_on_overflow = false;
+
+NumVal::NumVal(int64_t rep) {
+    this->tag = num_tag;
     this->rep = rep;
 }
 
+PTR(Val) NumVal::make(int64_t rep) {
+    static const std::vector<PTR(Val)> small = []() {
+        std::vector<PTR(Val)> vals;
+        for (int i = small_min; i < small_max; i++)
+            vals.push_back(NEW(NumVal)(i));
+        return vals;
+    }();
+
+    if (rep >= small_min && rep < small_max)
+        return small[rep - small_min];
+    return NEW(NumVal)(rep);
+}
+
 bool NumVal::equals(PTR(Val) other_val) {
-    PTR(NumVal) other_num_val = CAST(NumVal)(other_val);
-    if (other_num_val == nullptr)
+    if (other_val->tag != num_tag)
         return false;
     else
-        return rep == other_num_val->rep;
+        return rep == static_cast<NumVal *>(&*other_val)->rep;
 }
 
-PTR(Val) NumVal::add_to(PTR(Val) other_val) {
-    PTR(NumVal) other_num_val = CAST(NumVal)(other_val);
-    if (other_num_val == nullptr)
-        throw std::runtime_error("not a number");
+// Reads any number as a BigInt, for arithmetic that has overflowed or involves a BigNumVal.
+static BigInt big_rep(const PTR(Val) &val) {
+    if (val->tag == Val::num_tag)
+        return BigInt(static_cast<NumVal *>(&*val)->rep);
+    else if (val->tag == Val::big_tag)
+        return static_cast<BigNumVal *>(&*val)->rep;
     else
-        return NEW(NumVal)(rep + other_num_val->rep);
+        throw std::runtime_error("not a number");
+}
+
+static void check_promote() {
+    if (!NumVal::promote_on_overflow)
+        throw std::runtime_error("integer overflow");
+}
+
+PTR(Val) NumVal::add_to(PTR(Val) other_val) {
+    int64_t sum;
+    if (other_val->tag == num_tag && !__builtin_add_overflow(rep, static_cast<NumVal *>(&*other_val)->rep, &sum))
+        return NumVal::make(sum);
+    BigInt other_rep = big_rep(other_val);
+    if (other_val->tag == num_tag)
+        check_promote();
+    return BigNumVal::make(BigInt(rep) + other_rep);
 }
 
 PTR(Val) NumVal::mult_with(PTR(Val) other_val) {
-    PTR(NumVal) other_num_val = CAST(NumVal)(other_val);
-    if (other_num_val == nullptr)
-        throw std::runtime_error("not a number");
-    else
-        return NEW(NumVal)(rep * other_num_val->rep);
+    int64_t product;
+    if (other_val->tag == num_tag && !__builtin_mul_overflow(rep, static_cast<NumVal *>(&*other_val)->rep, &product))
+        return NumVal::make(product);
+    BigInt other_rep = big_rep(other_val);
+    if (other_val->tag == num_tag)
+        check_promote();
+    return BigNumVal::make(BigInt(rep) * other_rep);
 }
 
 PTR(Expr) NumVal::to_expr() {
@@ -50,23 +100,75 @@ bool NumVal::is_true() {
 }
 
 PTR(Val) NumVal::call(PTR(Val) actual_arg) {
-    return NEW(NumVal)(rep);
+    return THIS;
 }
 
-void NumVal::call_step(PTR(Val) actual_arg_val, PTR(Cont) rest) {
+void NumVal::call_step(PTR(Val) actual_arg_val, Step &step) {
     throw std::runtime_error("Cannot call call_step on a NumVal.");
 }
 
+BigNumVal::BigNumVal(const BigInt &rep) : rep(rep) {
+    this->tag = big_tag;
+}
+
+PTR(Val) BigNumVal::make(const BigInt &rep) {
+    int64_t small;
+    if (rep.to_int64(small))
+        return NumVal::make(small);
+    return NEW(BigNumVal)(rep);
+}
+
+bool BigNumVal::equals(PTR(Val) other_val) {
+    if (other_val->tag != big_tag)
+        return false;
+    else
+        return rep == static_cast<BigNumVal *>(&*other_val)->rep;
+}
+
+PTR(Val) BigNumVal::add_to(PTR(Val) other_val) {
+    return BigNumVal::make(rep + big_rep(other_val));
+}
+
+PTR(Val) BigNumVal::mult_with(PTR(Val) other_val) {
+    return BigNumVal::make(rep * big_rep(other_val));
+}
+
+PTR(Expr) BigNumVal::to_expr() {
+    return NEW(NumExpr)(rep);
+}
+
+std::string BigNumVal::to_string() {
+    return rep.to_string();
+}
+
+bool BigNumVal::is_true() {
+    throw std::runtime_error("a number cannot be interpreted as a boolean");
+}
+
+PTR(Val) BigNumVal::call(PTR(Val) actual_arg) {
+    return THIS;
+}
+
+void BigNumVal::call_step(PTR(Val) actual_arg_val, Step &step) {
+    throw std::runtime_error("Cannot call call_step on a BigNumVal.");
+}
+
 BoolVal::BoolVal(bool rep) {
+    this->tag = bool_tag;
     this->rep = rep;
 }
 
+PTR(Val) BoolVal::make(bool rep) {
+    static const PTR(Val) true_val = NEW(BoolVal)(true);
+    static const PTR(Val) false_val = NEW(BoolVal)(false);
+    return rep ? true_val : false_val;
+}
+
 bool BoolVal::equals(PTR(Val) other_val) {
-    PTR(BoolVal) other_bool_val = CAST(BoolVal)(other_val);
-    if (other_bool_val == nullptr)
+    if (other_val->tag != bool_tag)
         return false;
     else
-        return rep == other_bool_val->rep;
+        return rep == static_cast<BoolVal *>(&*other_val)->rep;
 }
 
 PTR(Val) BoolVal::add_to(PTR(Val) other_val) {
@@ -93,17 +195,102 @@ bool BoolVal::is_true() {
 }
 
 PTR(Val) BoolVal::call(PTR(Val) actual_arg) {
-    return NEW(BoolVal)(rep);
+    return THIS;
 }
 
-void BoolVal::call_step(PTR(Val) actual_arg_val, PTR(Cont) rest) {
+void BoolVal::call_step(PTR(Val) actual_arg_val, Step &step) {
     throw std::runtime_error("Cannot call call_step on a BoolVal.");
 }
 
-FunVal::FunVal(std::string formal_arg, PTR(Expr) body, PTR(Env) env) {
-    this->formal_arg = formal_arg;
+FunVal::FunVal(const Symbol &formal_arg, PTR(Expr) body, PTR(Env) env) : FunVal(formal_arg, body, env, -1) {
+}
+
+FunVal::FunVal(const Symbol &formal_arg, PTR(Expr) body, PTR(Env) env, int frame_size)
+        : FunVal(Symbol(), std::make_shared<const std::vector<Symbol>>(1, formal_arg), body, env, frame_size) {
+}
+
+FunVal::FunVal(const Symbol &self_name, var_list_t formal_args, PTR(Expr) body, PTR(Env) env, int frame_size) {
+    this->tag = fun_tag;
+    this->self_name = self_name;
+    this->formal_args = formal_args;
     this->body = body;
     this->env = env;
+    this->frame_size = frame_size;
+    self_name.hold();
+    for (const Symbol &formal_arg : *formal_args)
+        formal_arg.hold();
+}
+
+FunVal::FunVal(const Symbol &self_name, var_list_t formal_args, PTR(Expr) body, PTR(Env) env, int frame_size,
+               std::shared_ptr<const compiled_tail_t> code) : FunVal(self_name, formal_args, body, env, frame_size) {
+    this->code = code;
+}
+
+FunVal::~FunVal() {
+    self_name.drop();
+    for (const Symbol &formal_arg : *formal_args)
+        formal_arg.drop();
+    Teardown::release(body);
+    Teardown::release(env);
+}
+
+static void check_arity(const var_list_t &formal_args, size_t count) {
+    if (formal_args->size() != count)
+        throw std::runtime_error("wrong number of arguments");
+}
+
+// A recursive function binds itself anew for each call, so that
+// nothing it refers to refers back to it. In a frame, it takes the
+// slot after the arguments.
+PTR(Env) FunVal::self_env() {
+    if (self_name.str().empty())
+        return env;
+    return NEW(ExtendedEnv)(env, self_name, THIS);
+}
+
+PTR(Env) FunVal::bind_arg(PTR(Val) actual_arg) {
+    if (frame_size >= 0)
+        return bind_frame(actual_arg);
+    check_arity(formal_args, 1);
+    return NEW(ExtendedEnv)(self_env(), (*formal_args)[0], actual_arg);
+}
+
+PTR(FrameEnv) FunVal::bind_frame(PTR(Val) actual_arg) {
+    check_arity(formal_args, 1);
+    PTR(FrameEnv) frame = NEW(FrameEnv)(env, frame_size);
+    frame->slots[0] = actual_arg;
+    if (!self_name.str().empty())
+        frame->slots[1] = THIS;
+    return frame;
+}
+
+PTR(Val) FunVal::run_code(PTR(FrameEnv) frame) {
+    const compiled_tail_t *next_code = &*code;
+    PTR(Val) callee;
+    PTR(Val) next;
+    PTR(FrameEnv) next_frame;
+    PTR(Val) val = (*next_code)(frame, next, next_frame);
+    while (val == nullptr) {
+        // Keep the function being run alive while next is replaced.
+        callee = std::move(next);
+        frame = std::move(next_frame);
+        next_code = &*static_cast<FunVal *>(&*callee)->code;
+        val = (*next_code)(frame, next, next_frame);
+    }
+    return val;
+}
+
+// The arguments fill the first slots, so their vector becomes the
+// frame's slots without copying.
+PTR(FrameEnv) FunVal::bind_args(std::vector<PTR(Val)> actual_args) {
+    check_arity(formal_args, actual_args.size());
+    if (frame_size < 0)
+        return NEW(FrameEnv)(self_env(), formal_args, std::move(actual_args));
+
+    actual_args.resize(frame_size);
+    if (!self_name.str().empty())
+        actual_args[formal_args->size()] = THIS;
+    return NEW(FrameEnv)(env, nullptr, std::move(actual_args));
 }
 
 bool FunVal::equals(PTR(Val) other_val) {
@@ -111,7 +298,7 @@ bool FunVal::equals(PTR(Val) other_val) {
     if (f == nullptr)
         return false;
     else
-        return formal_arg == f->formal_arg && body->equals(f->body);
+        return self_name == f->self_name && *formal_args == *f->formal_args && body->equals(f->body);
 }
 
 PTR(Val) FunVal::add_to(PTR(Val) other_val) {
@@ -123,7 +310,7 @@ PTR(Val) FunVal::mult_with(PTR(Val) other_val) {
 }
 
 PTR(Expr) FunVal::to_expr() {
-    return NEW(FunExpr)(formal_arg, body);
+    return NEW(FunExpr)(self_name, formal_args, body);
 }
 
 std::string FunVal::to_string() {
@@ -135,14 +322,52 @@ bool FunVal::is_true() {
 }
 
 PTR(Val) FunVal::call(PTR(Val) actual_arg) {
-    return this->body->interp(NEW(ExtendedEnv)(env, formal_arg, actual_arg));
-}
-
-void FunVal::call_step(PTR(Val) actual_arg_val, PTR(Cont) rest) {
-    Step::mode = Step::interp_mode;
-    Step::expr = body;
-    Step::env = NEW(ExtendedEnv)(env, formal_arg, actual_arg_val);
-    Step::cont = rest;
+    if (code != nullptr)
+        return run_code(bind_frame(actual_arg));
+    if (MemoCache::memoizable(THIS, actual_arg)) {
+        PTR(Val) result = MemoCache::local().find(THIS, actual_arg);
+        if (result == nullptr) {
+            result = this->body->interp_trampoline(bind_arg(actual_arg));
+            MemoCache::local().store(THIS, actual_arg, result);
+        }
+        return result;
+    }
+    return this->body->interp_trampoline(bind_arg(actual_arg));
+}
+
+void FunVal::call_step(PTR(Val) actual_arg_val, Step &step) {
+    if (MemoCache::memoizable(THIS, actual_arg_val)) {
+        PTR(Val) result = MemoCache::local().find(THIS, actual_arg_val);
+        if (result != nullptr) {
+            step.mode = Step::continue_mode;
+            step.val = result;
+            return;
+        }
+        // A tail call gives the same value as the call it continues, so
+        // one frame caches the value for both.
+        if (step.conts.empty() || step.conts.back().tag != Cont::memo_store)
+            step.conts.push_back(Cont(Cont::memo_store, nullptr, nullptr));
+        std::vector<PTR(Val)> &calls = step.conts.back().vals;
+        if (calls.size() < 2 * MemoCache::capacity) {
+            calls.push_back(THIS);
+            calls.push_back(actual_arg_val);
+        }
+    }
+    step.mode = Step::interp_mode;
+    step.expr = body;
+    step.env = bind_arg(actual_arg_val);
+}
+
+PTR(Val) FunVal::call_with(std::vector<PTR(Val)> actual_args) {
+    if (code != nullptr)
+        return run_code(bind_args(std::move(actual_args)));
+    return this->body->interp_trampoline(bind_args(std::move(actual_args)));
+}
+
+void FunVal::call_step_with(std::vector<PTR(Val)> actual_arg_vals, Step &step) {
+    step.mode = Step::interp_mode;
+    step.expr = body;
+    step.env = bind_args(std::move(actual_arg_vals));
 }
 
 TEST_CASE( "values equals" ) {
@@ -193,4 +418,45 @@ TEST_CASE("is_true") {
     CHECK( (NEW(BoolVal)(true))->is_true() == true );
     CHECK( (NEW(BoolVal)(false))->is_true() == false );
     CHECK( (NEW(FunVal)("x", NEW(NumExpr)(10), Env::empty))->is_true() == false);
-}
\ No newline at end of file
+}
+
+TEST_CASE("shared small values") {
+    CHECK(NumVal::make(5) == NumVal::make(5));
+    CHECK(NumVal::make(-256) == NumVal::make(-256));
+    CHECK(NumVal::make(100000) != NumVal::make(100000));
+    CHECK(NumVal::make(100000)->equals(NEW(NumVal)(100000)));
+    CHECK(BoolVal::make(true) == BoolVal::make(true));
+    CHECK(BoolVal::make(false)->equals(NEW(BoolVal)(false)));
+
+    CHECK(Val::add(NumVal::make(5), NumVal::make(8)) == NumVal::make(13));
+    CHECK(Val::mult(NumVal::make(5), NumVal::make(8)) == NumVal::make(40));
+    CHECK_THROWS_WITH(Val::add(NumVal::make(5), BoolVal::make(false)), "not a number");
+    CHECK_THROWS_WITH(Val::mult(BoolVal::make(false), NumVal::make(5)), "no multiplying booleans");
+    CHECK(parse_str("_let x = 5 _in x * 3 + 1")->interp(Env::empty) == NumVal::make(16));
+    CHECK(parse_str("1 == 1")->interp(Env::empty) == BoolVal::make(true));
+}
+
+TEST_CASE("integer overflow") {
+    const int64_t max = INT64_MAX;
+    CHECK(Val::add(NumVal::make(max - 1), NumVal::make(1))->equals(NEW(NumVal)(max)));
+    CHECK(Val::mult(NumVal::make(3000000000), NumVal::make(3000000000))->to_string() == "9000000000000000000");
+    CHECK_THROWS_WITH(Val::add(NumVal::make(max), NumVal::make(1)), "integer overflow");
+    CHECK_THROWS_WITH(Val::mult(NumVal::make(max), NumVal::make(-2)), "integer overflow");
+    CHECK_THROWS_WITH(parse_str("9223372036854775807 + 1")->interp(Env::empty), "integer overflow");
+
+    NumVal::promote_on_overflow = true;
+    PTR(Val) big = Val::add(NumVal::make(max), NumVal::make(1));
+    CHECK(big->to_string() == "9223372036854775808");
+    CHECK(big->equals(NEW(BigNumVal)(BigInt::parse("9223372036854775808", false))));
+    CHECK(!big->equals(NEW(NumVal)(max)));
+    CHECK(Val::add(big, NumVal::make(-1))->equals(NEW(NumVal)(max)));
+    CHECK(CAST(NumVal)(Val::add(big, NumVal::make(-1))) != nullptr);
+    CHECK(Val::mult(big, big)->to_string() == "85070591730234615865843651857942052864");
+    CHECK_THROWS_WITH(Val::add(big, BoolVal::make(true)), "not a number");
+    CHECK_THROWS_WITH(big->is_true(), "a number cannot be interpreted as a boolean");
+    CHECK(parse_str("99999999999999999999 * 10 + 1")->interp(Env::empty)->to_string() == "999999999999999999991");
+    CHECK(parse_str("_let x = 9223372036854775807 _in x + x == 18446744073709551614")->interp(Env::empty)->is_true());
+    CHECK_THROWS_WITH(Step::interp_by_steps(parse_str("(99999999999999999999)(1)")),
+                      "Cannot call call_step on a BigNumVal.");
+    NumVal::promote_on_overflow = false;
+}
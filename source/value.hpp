@@ -4,17 +4,35 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 #include "pointer.hpp"
+#include "symbol.hpp"
+#include "bignum.hpp"
 
 /* A forward declaration, so `Val` can refer to `Expr` and 'Env', while
    `Expr` still needs to refer to `Val`. */
 class Expr;
 class Env;
-class Cont;
+class FrameEnv;
+class Step;
 
 class Val ENABLE_THIS(Val){
 public:
+    typedef enum {
+        num_tag,
+        bool_tag,
+        fun_tag,
+        big_tag
+    } tag_t;
+
+    /* Set by each subclass, so hot paths can test the kind of a value
+       without a virtual call or a dynamic cast. */
+    tag_t tag;
+
     virtual bool equals(PTR(Val) val) = 0;
     virtual PTR(Val) add_to(PTR(Val) other_val) = 0;
     virtual PTR(Val) mult_with(PTR(Val) other_val) = 0;
@@ -22,23 +40,63 @@ public:
     virtual std::string to_string() = 0;
     virtual bool is_true() = 0;
     virtual PTR(Val) call(PTR(Val) actual_arg) = 0;
-    virtual void call_step(PTR(Val) actual_arg_val, PTR(Cont) rest) = 0;
+    virtual void call_step(PTR(Val) actual_arg_val, Step &step) = 0;
+
+    /**
+     * Calls this Val with several arguments at once. Only functions take more than one, so anything else is
+     * called with just the first and fails or answers as it would for that call.
+     * @param actual_args Vals for the arguments, in order.
+     * @return result of the call.
+     */
+    virtual PTR(Val) call_with(std::vector<PTR(Val)> actual_args);
+    virtual void call_step_with(std::vector<PTR(Val)> actual_arg_vals, Step &step);
+
+    /**
+     * Adds two Vals. Two numbers are added inline unless the sum overflows, and anything else is handed to
+     * <code>add_to</code>.
+     * @param lhs_val left hand side Val.
+     * @param rhs_val right hand side Val.
+     * @return Val holding the sum.
+     */
+    static PTR(Val) add(const PTR(Val) &lhs_val, const PTR(Val) &rhs_val);
+
+    /**
+     * Multiplies two Vals. Two numbers are multiplied inline unless the product overflows, and anything else is
+     * handed to <code>mult_with</code>.
+     * @param lhs_val left hand side Val.
+     * @param rhs_val right hand side Val.
+     * @return Val holding the product.
+     */
+    static PTR(Val) mult(const PTR(Val) &lhs_val, const PTR(Val) &rhs_val);
 };
 
 
 /**
- * Stores an int. Can be returned from the <code>interp()</code> method of an Expr.
+ * Stores a 64-bit int. Can be returned from the <code>interp()</code> method of an Expr.
  * The actual int can be accessed via the <code>rep</code> member variable.
+ * Arithmetic that overflows throws an error, or makes a BigNumVal if <code>promote_on_overflow</code> is set.
  */
 class NumVal : public Val {
 public:
-    int rep;
+    int64_t rep;
+
+    /* Set once at startup to make overflowing arithmetic produce BigNumVals instead of failing. */
+    static bool promote_on_overflow;
 
     /**
      * Constructs a NumVal with the provided int.
      * @param rep int to be stored in NumVal.
      */
-    NumVal(int rep);
+    NumVal(int64_t rep);
+
+    /**
+     * Returns a NumVal for the provided int. Small ints are shared, preallocated NumVals, so most arithmetic
+     * does not allocate.
+     * @param rep int to be stored in NumVal.
+     * @return NumVal holding rep.
+     */
+    static PTR(Val) make(int64_t rep);
+
     bool equals(PTR(Val) val);
 
     PTR(Val) add_to(PTR(Val) other_val);
@@ -47,7 +105,7 @@ public:
     std::string to_string();
     bool is_true();
     PTR(Val) call(PTR(Val) actual_arg);
-    void call_step(PTR(Val) actual_arg_val, PTR(Cont) rest);
+    void call_step(PTR(Val) actual_arg_val, Step &step);
 };
 
 /**
@@ -64,6 +122,45 @@ public:
      */
     BoolVal(bool rep);
 
+    /**
+     * Returns one of the two shared BoolVals, without allocating.
+     * @param rep bool to be stored in BoolVal.
+     * @return BoolVal holding rep.
+     */
+    static PTR(Val) make(bool rep);
+
+    bool equals(PTR(Val) val);
+
+    PTR(Val) add_to(PTR(Val) other_val);
+    PTR(Val) mult_with(PTR(Val) other_val);
+    PTR(Expr) to_expr();
+    std::string to_string();
+    bool is_true();
+    PTR(Val) call(PTR(Val) actual_arg);
+    void call_step(PTR(Val) actual_arg_val, Step &step);
+};
+
+/**
+ * Stores an integer outside the range of NumVal, made only when <code>NumVal::promote_on_overflow</code> is set.
+ * Results that fit back in a NumVal become NumVals again, so every number has exactly one representation.
+ */
+class BigNumVal : public Val {
+public:
+    BigInt rep;
+
+    /**
+     * Constructs a BigNumVal with the provided integer.
+     * @param rep integer to be stored in BigNumVal.
+     */
+    BigNumVal(const BigInt &rep);
+
+    /**
+     * Returns a NumVal if the integer fits in one, and a BigNumVal otherwise.
+     * @param rep integer to be stored.
+     * @return Val holding rep.
+     */
+    static PTR(Val) make(const BigInt &rep);
+
     bool equals(PTR(Val) val);
 
     PTR(Val) add_to(PTR(Val) other_val);
@@ -72,17 +169,30 @@ public:
     std::string to_string();
     bool is_true();
     PTR(Val) call(PTR(Val) actual_arg);
-    void call_step(PTR(Val) actual_arg_val, PTR(Cont) rest);
+    void call_step(PTR(Val) actual_arg_val, Step &step);
 };
 
+/* An Expr compiled by <code>Expr::compile_closure</code>. It is called with the frame of the function it
+   appears in. */
+typedef std::function<PTR(Val)(const PTR(FrameEnv) &frame)> compiled_t;
+
+/* An Expr compiled by <code>Expr::compile_tail_closure</code>. A call to a compiled function that it ends with
+   is not made: the function is stored in next and the frame to run it with in next_frame, and nullptr is
+   returned. */
+typedef std::function<PTR(Val)(const PTR(FrameEnv) &frame, PTR(Val) &next, PTR(FrameEnv) &next_frame)>
+        compiled_tail_t;
+
 /**
  * Stores the components of a function. Can be returned from the <code>interp()</code> method of an Expr.
  */
 class FunVal : public Val {
 public:
-    std::string formal_arg;
+    Symbol self_name;
+    var_list_t formal_args;
     PTR(Expr) body;
     PTR(Env) env;
+    int frame_size;
+    std::shared_ptr<const compiled_tail_t> code;
 
     /**
      * Constructs a FunVal from a string formal_arg, Expr body, and Env env.
@@ -90,7 +200,73 @@ public:
      * @param body Expr representing the actual function.
      * @param env Env to pass along into the FunVal.
      */
-    FunVal(std::string formal_arg, PTR(Expr) body, PTR(Env) env);
+    FunVal(const Symbol &formal_arg, PTR(Expr) body, PTR(Env) env);
+
+    /**
+     * Constructs a FunVal whose calls bind their variables into a frame.
+     * @param formal_arg string representing the formal_arg.
+     * @param body Expr representing the actual function.
+     * @param env Env to pass along into the FunVal.
+     * @param frame_size number of slots in the frame of each call.
+     */
+    FunVal(const Symbol &formal_arg, PTR(Expr) body, PTR(Env) env, int frame_size);
+
+    /**
+     * Constructs a FunVal that takes any number of arguments. A recursive FunVal is not bound in env, which
+     * would make env refer back to it; each call binds it to self_name instead.
+     * @param self_name name the function is bound to in its own body, or the empty Symbol.
+     * @param formal_args names of the arguments, in order.
+     * @param body Expr representing the actual function.
+     * @param env Env to pass along into the FunVal.
+     * @param frame_size number of slots in the frame of each call, or -1 to bind the arguments by name.
+     */
+    FunVal(const Symbol &self_name, var_list_t formal_args, PTR(Expr) body, PTR(Env) env, int frame_size);
+
+    /**
+     * Constructs a FunVal whose calls run compiled code instead of interpreting the body.
+     * @param self_name name the function is bound to in its own body, or the empty Symbol.
+     * @param formal_args names of the arguments, in order.
+     * @param body Expr representing the actual function.
+     * @param env frame the function was made in.
+     * @param frame_size number of slots in the frame of each call.
+     * @param code body compiled by <code>Expr::compile_tail_closure</code>.
+     */
+    FunVal(const Symbol &self_name, var_list_t formal_args, PTR(Expr) body, PTR(Env) env, int frame_size,
+           std::shared_ptr<const compiled_tail_t> code);
+    ~FunVal();
+
+    /**
+     * Makes the Env that the body of the function is evaluated in.
+     * /exception If the function does not take exactly one argument, an error will be thrown.
+     * @param actual_arg Val to bind to formal_arg.
+     * @return Env with formal_arg bound.
+     */
+    PTR(Env) bind_arg(PTR(Val) actual_arg);
+
+    /**
+     * Makes the single frame that holds every argument of a call.
+     * /exception If the number of arguments does not match formal_args, an error will be thrown.
+     * @param actual_args Vals to bind to formal_args, in order.
+     * @return frame with every formal argument bound.
+     */
+    PTR(FrameEnv) bind_args(std::vector<PTR(Val)> actual_args);
+
+    /**
+     * Makes the frame for a call with one argument to a function whose variables are bound in a frame.
+     * /exception If the function does not take exactly one argument, an error will be thrown.
+     * @param actual_arg Val to bind to formal_arg.
+     * @return frame with formal_arg bound.
+     */
+    PTR(FrameEnv) bind_frame(PTR(Val) actual_arg);
+
+    /**
+     * Runs the compiled code with a frame made by <code>bind_frame</code> or <code>bind_args</code>, and then
+     * each compiled function it calls in tail position in turn, so those calls do not grow the C++ stack.
+     * @param frame frame of the call.
+     * @return Val of the call.
+     */
+    PTR(Val) run_code(PTR(FrameEnv) frame);
+    PTR(Env) self_env();
 
     bool equals(PTR(Val) val);
 
@@ -100,7 +276,24 @@ public:
     std::string to_string();
     bool is_true();
     PTR(Val) call(PTR(Val) actual_arg);
-    void call_step(PTR(Val) actual_arg_val, PTR(Cont) rest);
+    void call_step(PTR(Val) actual_arg_val, Step &step);
+    PTR(Val) call_with(std::vector<PTR(Val)> actual_args);
+    void call_step_with(std::vector<PTR(Val)> actual_arg_vals, Step &step);
 };
 
+inline PTR(Val) Val::add(const PTR(Val) &lhs_val, const PTR(Val) &rhs_val) {
+    int64_t sum;
+    if (lhs_val->tag == num_tag && rhs_val->tag == num_tag
+        && !__builtin_add_overflow(static_cast<NumVal *>(&*lhs_val)->rep, static_cast<NumVal *>(&*rhs_val)->rep, &sum))
+        return NumVal::make(sum);
+    return lhs_val->add_to(rhs_val);
+}
 
+inline PTR(Val) Val::mult(const PTR(Val) &lhs_val, const PTR(Val) &rhs_val) {
+    int64_t product;
+    if (lhs_val->tag == num_tag && rhs_val->tag == num_tag
+        && !__builtin_mul_overflow(static_cast<NumVal *>(&*lhs_val)->rep, static_cast<NumVal *>(&*rhs_val)->rep,
+                                   &product))
+        return NumVal::make(product);
+    return lhs_val->mult_with(rhs_val);
+}